@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""Throughput benchmarks of convolution, prefixsum and flow-graph.
+
+Runs the benchmark executables of a build of the root CMakeLists.txt, collects their JSON into one results file
+and optionally compares it with the results of another build:
+
+    cmake -S . -B build -DCMAKE_BUILD_TYPE=Release && cmake --build build
+    python3 bench/run.py --build build --out before.json
+    ... change, rebuild ...
+    python3 bench/run.py --build build --out after.json --compare before.json
+
+OpenCL cases run on the device the labs pick, on CPU-only machines that is pocl. Cases without a device
+are reported as skipped. Kernels come from the program binary cache, so only the first run compiles them.
+The exit status is 1 if a case got slower than the threshold allows or failed the check of its results.
+"""
+
+import argparse
+import json
+import math
+import os
+import platform
+import subprocess
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# executable in the build directory, smaller sweep
+TARGETS = {
+    'convolution': ('lab1/convolution_bench', 'n:256/'),
+    'prefixsum': ('lab2/prefixsum_bench', 'n:(65536|1048576)(/|$)'),
+    'flow-graph': ('flow-graph/flow-graph-bench', 'size:256/count:16/'),
+}
+
+
+def run_target(name, args):
+    executable, quick_filter = TARGETS[name]
+    executable = os.path.abspath(os.path.join(args.build, executable))
+    if not os.path.exists(executable):
+        sys.exit('{} is not built: {} not found'.format(name, executable))
+
+    command = [executable]
+    if name == 'convolution' and args.device:
+        command += ['-d', args.device]
+    command += ['--format', 'json', '--repetitions', str(args.repetitions), '--min-time', str(args.min_time)]
+    if args.filter or args.quick:
+        command += ['--filter', args.filter or quick_filter]
+
+    print('running {}'.format(' '.join(command)), file=sys.stderr)
+    # the executables exit with 1 if a case failed its check, the results still say which one
+    process = subprocess.run(command, stdout=subprocess.PIPE)
+    if process.returncode not in (0, 1):
+        sys.exit('{} exited with {}'.format(executable, process.returncode))
+    return json.loads(process.stdout.decode())
+
+
+def git_revision():
+    try:
+        return subprocess.run(['git', 'rev-parse', '--short', 'HEAD'], cwd=ROOT, stdout=subprocess.PIPE,
+                              stderr=subprocess.DEVNULL, check=True).stdout.decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return ''
+
+
+def cases(results):
+    for target, result in results['targets'].items():
+        for case in result['benchmarks']:
+            yield '{}/{}'.format(target, case['name']), case
+
+
+def format_rate(value, stddev, unit):
+    for scale, prefix in ((1e9, 'G'), (1e6, 'M'), (1e3, 'k'), (1, '')):
+        if value >= scale:
+            return '{:.3g} ± {:.2g} {}{}/s'.format(value / scale, stddev / scale, prefix, unit)
+    return '{:.3g} ± {:.2g} {}/s'.format(value, stddev, unit)
+
+
+def print_table(results):
+    print('{:<64} {:>12} {:>7} {:>20} {:>28}'.format('case', 'time/iter', 'cv', 'throughput', 'rate'))
+    for name, case in cases(results):
+        if 'skipped' in case:
+            print('{:<64} skipped: {}'.format(name, case['skipped']))
+            continue
+        if 'failed' in case:
+            print('{:<64} FAILED: {}'.format(name, case['failed']))
+            continue
+        print('{:<64} {:>10.4g}ms {:>6.2f}% {:>20} {:>28}'.format(
+            name, case['time_mean_s'] * 1e3, case['time_cv'] * 100,
+            format_rate(case['bytes_per_second'], case['bytes_per_second_stddev'], 'B'),
+            format_rate(case['items_per_second'], case['items_per_second_stddev'], case['items_unit'])))
+
+
+def compare(results, baseline, threshold):
+    """Prints the cases whose rate changed, returns the number of regressions.
+
+    A case regressed if its rate dropped by more than `threshold` and by more than twice the combined
+    standard deviation of both runs, so that noisy cases do not fail the comparison."""
+    old_cases = dict(cases(baseline))
+    regressions = 0
+    print('\n{:<64} {:>14} {:>14} {:>9}'.format('case', 'baseline', 'current', 'change'))
+    for name, case in cases(results):
+        old = old_cases.get(name)
+        if old is None or any(key in record for key in ('skipped', 'failed') for record in (case, old)) \
+                or not old['items_per_second']:
+            continue
+        change = case['items_per_second'] / old['items_per_second'] - 1
+        noise = math.hypot(case['items_per_second_stddev'], old['items_per_second_stddev'])
+        drop = old['items_per_second'] - case['items_per_second']
+        regressed = change < -threshold and drop > 2 * noise
+        regressions += regressed
+        if regressed or abs(change) > threshold:
+            print('{:<64} {:>14.4g} {:>14.4g} {:>+8.1f}%{}'.format(
+                name, old['items_per_second'], case['items_per_second'], change * 100,
+                '  REGRESSION' if regressed else ''))
+    print('{} regression(s), baseline {} ({}), current {} ({})'.format(
+        regressions, baseline['context'].get('revision', '?'), baseline['context'].get('date', '?'),
+        results['context'].get('revision', '?'), results['context'].get('date', '?')))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--build', default='build', help='CMake build directory of the repository root')
+    parser.add_argument('--targets', default=','.join(TARGETS), help='comma separated, all of them by default')
+    parser.add_argument('--filter', help='regex of the case names to run, all of them by default')
+    parser.add_argument('--quick', action='store_true', help='only the smallest sizes, unless --filter is given')
+    parser.add_argument('--repetitions', type=int, default=5, help='repetitions of every case (default 5)')
+    parser.add_argument('--min-time', type=float, default=0.5, help='seconds of one repetition (default 0.5)')
+    parser.add_argument('--device', help='OpenCL device of convolution, an index or a part of its name')
+    parser.add_argument('--out', default='bench-results.json', help='results file (default bench-results.json)')
+    parser.add_argument('--compare', help='results file of a baseline build')
+    parser.add_argument('--threshold', type=float, default=0.05,
+                        help='relative rate drop that counts as a regression (default 0.05)')
+    args = parser.parse_args()
+
+    results = {
+        'context': {
+            'revision': git_revision(),
+            'machine': platform.machine(),
+            'processor': platform.processor(),
+            'system': platform.platform(),
+            'cpus': os.cpu_count(),
+            'repetitions': args.repetitions,
+            'min_time_s': args.min_time,
+        },
+        'targets': {},
+    }
+    for target in args.targets.split(','):
+        if target not in TARGETS:
+            sys.exit('unknown target {}, expected one of {}'.format(target, ', '.join(TARGETS)))
+        results['targets'][target] = run_target(target, args)
+    results['context']['date'] = next(iter(results['targets'].values()))['context']['date']
+
+    with open(args.out, 'w') as out:
+        json.dump(results, out, indent=1)
+    print_table(results)
+    failed = sum('failed' in case for _, case in cases(results))
+
+    if args.compare:
+        with open(args.compare) as baseline:
+            if compare(results, json.load(baseline), args.threshold):
+                sys.exit(1)
+    if failed:
+        sys.exit('{} case(s) failed the check of their results'.format(failed))
+
+
+if __name__ == '__main__':
+    main()
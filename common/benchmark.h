@@ -0,0 +1,406 @@
+#ifndef AU_PARALLEL_COMPUTING_BENCHMARK_H
+#define AU_PARALLEL_COMPUTING_BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+/**
+ * Throughput benchmarks of the labs, in the manner of Google Benchmark but without the dependency.
+ *
+ *     void convolve(benchmark::state &state) {
+ *         auto n = state.range(0);
+ *         ...                              // setup, not timed
+ *         while (state.keep_running()) {
+ *             ...                          // one timed iteration
+ *         }
+ *         state.set_bytes_processed(...);  // per iteration
+ *         state.set_items_processed(n * n, "elements");
+ *     }
+ *
+ *     benchmark::add("convolve", convolve).ranges({{"n", {256, 1024}}, {"m", {3, 9}}});
+ *     return benchmark::run(argc, argv);
+ *
+ * Every combination of the ranges is a case `convolve/n:256/m:3`. A case is repeated, every repetition
+ * runs iterations for at least the minimum time, rates are reported as the mean and the standard deviation
+ * over the repetitions. Results are printed as a table or as JSON for the driver script (bench/run.py).
+ * A case that checks its results calls state.fail when they are wrong, the run then exits with 1.
+ */
+namespace benchmark {
+    typedef std::chrono::steady_clock clock;
+
+    class state {
+    public:
+        state(std::vector<long> args, double min_time) : args(std::move(args)), min_time(min_time) {}
+
+        long range(size_t i) const {
+            return args.at(i);
+        }
+
+        // true while more iterations are needed, times everything between the calls
+        bool keep_running() {
+            auto now = clock::now();
+            if (!started) {
+                started = true;
+                resumed = now;
+                return true;
+            }
+            if (!paused) {
+                elapsed += std::chrono::duration<double>(now - resumed).count();
+            }
+            iterations++;
+            if (!skip_reason.empty() || !failure.empty() || elapsed >= min_time) {
+                return false;
+            }
+            paused = false;
+            resumed = clock::now();
+            return true;
+        }
+
+        // the rest of the iteration up to resume_timing is not timed
+        void pause_timing() {
+            elapsed += std::chrono::duration<double>(clock::now() - resumed).count();
+            paused = true;
+        }
+
+        void resume_timing() {
+            paused = false;
+            resumed = clock::now();
+        }
+
+        // bytes read and written by one iteration
+        void set_bytes_processed(double bytes) {
+            bytes_per_iteration = bytes;
+        }
+
+        // elements, images... of one iteration
+        void set_items_processed(double items, const std::string &unit) {
+            items_per_iteration = items;
+            items_unit = unit;
+        }
+
+        void set_label(const std::string &text) {
+            label = text;
+        }
+
+        // the case cannot run here, e.g. there is no OpenCL device; must be called before keep_running
+        void skip(const std::string &reason) {
+            skip_reason = reason;
+        }
+
+        // results of the case are wrong, its rates mean nothing; the iteration in progress is the last one
+        void fail(const std::string &reason) {
+            failure = reason;
+        }
+
+    private:
+        friend class runner;
+
+        std::vector<long> args;
+        double min_time;
+
+        bool started = false;
+        bool paused = false;
+        clock::time_point resumed;
+        double elapsed = 0;
+        size_t iterations = 0;
+
+        double bytes_per_iteration = 0;
+        double items_per_iteration = 0;
+        std::string items_unit;
+        std::string label;
+        std::string skip_reason;
+        std::string failure;
+    };
+
+    typedef std::function<void(state &)> function;
+
+    struct range {
+        std::string name;
+        std::vector<long> values;
+    };
+
+    class registration {
+    public:
+        registration(std::string name, function body) : name(std::move(name)), body(std::move(body)) {}
+
+        // a case for every combination of the values, the first range changes slowest
+        registration &ranges(std::vector<range> ranges) {
+            arg_ranges = std::move(ranges);
+            return *this;
+        }
+
+    private:
+        friend class runner;
+
+        std::string name;
+        function body;
+        std::vector<range> arg_ranges;
+    };
+
+    inline std::vector<std::unique_ptr<registration> > &registrations() {
+        static std::vector<std::unique_ptr<registration> > all;
+        return all;
+    }
+
+    inline registration &add(const std::string &name, function body) {
+        registrations().emplace_back(new registration(name, std::move(body)));
+        return *registrations().back();
+    }
+
+    // mean and standard deviation of a sample
+    struct statistic {
+        double mean;
+        double stddev;
+
+        explicit statistic(const std::vector<double> &values) : mean(0), stddev(0) {
+            if (values.empty()) {
+                return;
+            }
+            for (auto value : values) {
+                mean += value;
+            }
+            mean /= values.size();
+            if (values.size() > 1) {
+                for (auto value : values) {
+                    stddev += (value - mean) * (value - mean);
+                }
+                stddev = std::sqrt(stddev / (values.size() - 1));
+            }
+        }
+
+        double cv() const {
+            return mean > 0 ? stddev / mean : 0;
+        }
+    };
+
+    inline std::string json_string(const std::string &value) {
+        std::string result = "\"";
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+            }
+            result += c;
+        }
+        return result + "\"";
+    }
+
+    class runner {
+    public:
+        void usage(const char *name) const {
+            std::cerr << "Usage: " << name
+                      << " [--filter regex] [--repetitions N] [--min-time seconds] [--format console|json] [--list]"
+                      << std::endl
+                      << "  --filter       run only the cases whose names match, all of them by default" << std::endl
+                      << "  --repetitions  times every case is repeated, 5 by default" << std::endl
+                      << "  --min-time     least time of the iterations of a repetition, 0.5 s by default" << std::endl
+                      << "  --format       a table or one JSON object, console by default" << std::endl
+                      << "  --list         print the case names and exit" << std::endl;
+        }
+
+        bool parse(int argc, char **argv) {
+            for (int i = 1; i < argc; i += 2) {
+                std::string flag = argv[i];
+                if (flag == "--list") {
+                    list = true;
+                    i--;
+                } else if (flag == "--filter" && i + 1 < argc) {
+                    filter = argv[i + 1];
+                } else if (flag == "--repetitions" && i + 1 < argc) {
+                    repetitions = std::max(1ul, std::stoul(argv[i + 1]));
+                } else if (flag == "--min-time" && i + 1 < argc) {
+                    min_time = std::stod(argv[i + 1]);
+                } else if (flag == "--format" && i + 1 < argc && std::string(argv[i + 1]) == "console") {
+                    json = false;
+                } else if (flag == "--format" && i + 1 < argc && std::string(argv[i + 1]) == "json") {
+                    json = true;
+                } else {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        int run(const char *executable) {
+            std::regex pattern(filter);
+            std::vector<std::string> results;
+            if (!json && !list) {
+                std::cout << std::left << std::setw(48) << "case" << std::right << std::setw(14) << "time/iter"
+                          << std::setw(8) << "cv" << std::setw(18) << "GB/s" << std::setw(26) << "items/s"
+                          << std::endl;
+            }
+
+            for (const auto &benchmark : registrations()) {
+                for (const auto &args : combinations(benchmark->arg_ranges)) {
+                    auto name = case_name(*benchmark, args);
+                    if (!std::regex_search(name, pattern)) {
+                        continue;
+                    }
+                    if (list) {
+                        std::cout << name << std::endl;
+                        continue;
+                    }
+                    results.push_back(run_case(*benchmark, name, args));
+                }
+            }
+
+            if (json && !list) {
+                print_json(executable, results);
+            }
+            return failed ? 1 : 0;
+        }
+
+    private:
+        static std::vector<std::vector<long> > combinations(const std::vector<range> &ranges) {
+            std::vector<std::vector<long> > result(1);
+            for (const auto &arg_range : ranges) {
+                std::vector<std::vector<long> > extended;
+                for (const auto &prefix : result) {
+                    for (auto value : arg_range.values) {
+                        extended.push_back(prefix);
+                        extended.back().push_back(value);
+                    }
+                }
+                result.swap(extended);
+            }
+            return result;
+        }
+
+        static std::string case_name(const registration &benchmark, const std::vector<long> &args) {
+            std::string name = benchmark.name;
+            for (size_t i = 0; i < args.size(); ++i) {
+                name += "/" + benchmark.arg_ranges[i].name + ":" + std::to_string(args[i]);
+            }
+            return name;
+        }
+
+        // runs the repetitions of a case, prints a table row and returns its JSON
+        std::string run_case(const registration &benchmark, const std::string &name, const std::vector<long> &args) {
+            std::vector<double> times;
+            std::vector<double> byte_rates;
+            std::vector<double> item_rates;
+            size_t iterations = 0;
+            std::string items_unit;
+            std::string label;
+            std::string skip_reason;
+            std::string failure;
+
+            for (size_t repetition = 0; repetition < repetitions && skip_reason.empty(); ++repetition) {
+                state current(args, min_time);
+                benchmark.body(current);
+                skip_reason = current.skip_reason;
+                failure = current.failure;
+                if (!skip_reason.empty() || !failure.empty() || current.iterations == 0) {
+                    break;
+                }
+                double time = current.elapsed / current.iterations;
+                times.push_back(time);
+                byte_rates.push_back(current.bytes_per_iteration / time);
+                item_rates.push_back(current.items_per_iteration / time);
+                iterations += current.iterations;
+                items_unit = current.items_unit;
+                label = current.label;
+            }
+
+            statistic time(times);
+            statistic bytes(byte_rates);
+            statistic items(item_rates);
+
+            if (!json) {
+                std::cout << std::left << std::setw(48) << name << std::right;
+                if (!skip_reason.empty()) {
+                    std::cout << "  skipped: " << skip_reason << std::endl;
+                } else if (!failure.empty()) {
+                    std::cout << "  FAILED: " << failure << std::endl;
+                } else {
+                    std::ostringstream items_text;
+                    items_text << std::setprecision(4) << items.mean << " " << items_unit << "/s";
+                    std::cout << std::setprecision(4) << std::setw(12) << time.mean * 1e3 << "ms"
+                              << std::setw(7) << time.cv() * 100 << "%"
+                              << std::setw(18) << bytes.mean / 1e9 << std::setw(26) << items_text.str();
+                    if (!label.empty()) {
+                        std::cout << "  " << label;
+                    }
+                    std::cout << std::endl;
+                }
+            }
+
+            std::ostringstream out;
+            out.precision(9);
+            out << "{\"name\": " << json_string(name) << ", \"benchmark\": " << json_string(benchmark.name)
+                << ", \"args\": {";
+            for (size_t i = 0; i < args.size(); ++i) {
+                out << (i ? ", " : "") << json_string(benchmark.arg_ranges[i].name) << ": " << args[i];
+            }
+            out << "}";
+            if (!skip_reason.empty()) {
+                out << ", \"skipped\": " << json_string(skip_reason) << "}";
+                return out.str();
+            }
+            if (!failure.empty()) {
+                failed = true;
+                out << ", \"failed\": " << json_string(failure) << "}";
+                return out.str();
+            }
+            out << ", \"label\": " << json_string(label)
+                << ", \"repetitions\": " << times.size() << ", \"iterations\": " << iterations
+                << ", \"time_mean_s\": " << time.mean << ", \"time_stddev_s\": " << time.stddev
+                << ", \"time_cv\": " << time.cv()
+                << ", \"bytes_per_second\": " << bytes.mean << ", \"bytes_per_second_stddev\": " << bytes.stddev
+                << ", \"items_per_second\": " << items.mean << ", \"items_per_second_stddev\": " << items.stddev
+                << ", \"items_unit\": " << json_string(items_unit) << "}";
+            return out.str();
+        }
+
+        void print_json(const char *executable, const std::vector<std::string> &results) const {
+            char host[256] = {0};
+            gethostname(host, sizeof(host) - 1);
+            char date[32];
+            auto now = std::time(nullptr);
+            std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+            std::cout << "{\"context\": {\"executable\": " << json_string(executable)
+                      << ", \"date\": " << json_string(date) << ", \"host\": " << json_string(host)
+                      << ", \"hardware_threads\": " << std::thread::hardware_concurrency()
+                      << ", \"repetitions\": " << repetitions << ", \"min_time_s\": " << min_time
+                      << "},\n \"benchmarks\": [";
+            for (size_t i = 0; i < results.size(); ++i) {
+                std::cout << (i ? ",\n  " : "\n  ") << results[i];
+            }
+            std::cout << "\n]}" << std::endl;
+        }
+
+        std::string filter = ".*";
+        size_t repetitions = 5;
+        double min_time = 0.5;
+        bool json = false;
+        bool list = false;
+        // some case called state.fail
+        bool failed = false;
+    };
+
+    // runs the registered cases as the command line says
+    inline int run(int argc, char **argv) {
+        runner benchmarks;
+        if (!benchmarks.parse(argc, argv)) {
+            benchmarks.usage(argv[0]);
+            return 1;
+        }
+        return benchmarks.run(argv[0]);
+    }
+}
+
+
+#endif //AU_PARALLEL_COMPUTING_BENCHMARK_H
@@ -0,0 +1,329 @@
+#ifndef AU_PARALLEL_COMPUTING_BINARY_IO_H
+#define AU_PARALLEL_COMPUTING_BINARY_IO_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "binary_io reads and writes raw little-endian values"
+#endif
+
+/**
+ * Compact binary input/output shared by the labs.
+ *
+ * A file is a sequence of records, every record is
+ *     char magic[4] = "AUPC", uint32 dtype, uint32 rank, uint32 reserved, uint64 dims[rank]
+ * followed by dims[0] * ... * dims[rank - 1] raw little-endian values (row-major),
+ * zero-padded to a multiple of 8 bytes so that the data of every record in a mapped file is aligned.
+ * Files that do not start with the magic are text and are parsed as before.
+ *
+ * Files come from the user, so broken records and failed system calls throw binary_io::error
+ * in every build, the mains print it and exit.
+ */
+namespace binary_io {
+    enum class dtype : uint32_t {
+        float32 = 1,
+        int32 = 2,
+        int64 = 3,
+        float64 = 4,
+        uint8 = 5
+    };
+
+    const char MAGIC[4] = {'A', 'U', 'P', 'C'};
+
+    // a file that can not be opened, mapped or written, or a broken record
+    class error : public std::runtime_error {
+    public:
+        explicit error(const std::string &message) : std::runtime_error(message) {}
+    };
+
+    inline bool is_dtype(uint32_t type) {
+        return type >= (uint32_t) dtype::float32 && type <= (uint32_t) dtype::uint8;
+    }
+
+    inline size_t dtype_size(dtype type) {
+        switch (type) {
+            case dtype::float32:
+            case dtype::int32:
+                return 4;
+            case dtype::int64:
+            case dtype::float64:
+                return 8;
+            case dtype::uint8:
+                return 1;
+        }
+        assert(0 && "Unknown dtype");
+        return 0;
+    }
+
+    // dtype of records holding values of type T
+    template<class T>
+    dtype dtype_of();
+
+    template<>
+    inline dtype dtype_of<float>() { return dtype::float32; }
+
+    template<>
+    inline dtype dtype_of<int32_t>() { return dtype::int32; }
+
+    template<>
+    inline dtype dtype_of<int64_t>() { return dtype::int64; }
+
+    template<>
+    inline dtype dtype_of<double>() { return dtype::float64; }
+
+    template<>
+    inline dtype dtype_of<uint8_t>() { return dtype::uint8; }
+
+    struct array_view {
+        dtype type;
+        std::vector<uint64_t> dims;
+        const void *data;
+
+        size_t count() const {
+            size_t count = 1;
+            for (auto dim : dims) {
+                count *= dim;
+            }
+            return count;
+        }
+    };
+
+    // true if the file starts with a binary record
+    inline bool is_binary(const std::string &path) {
+        char magic[sizeof(MAGIC)] = {0};
+        std::ifstream in(path, std::ios::binary);
+        in.read(magic, sizeof(magic));
+        return in && std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+    }
+
+    // read-only mapping of a whole file
+    class mapped_file {
+    public:
+        explicit mapped_file(const std::string &path) : ptr(nullptr), sz(0) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw error("Could not open " + path);
+            }
+
+            struct stat file_stat;
+            if (fstat(fd, &file_stat) != 0) {
+                close(fd);
+                throw error("Could not stat " + path);
+            }
+            sz = (size_t) file_stat.st_size;
+            if (sz != 0) {
+                ptr = mmap(nullptr, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (ptr == MAP_FAILED) {
+                    close(fd);
+                    throw error("Could not map " + path);
+                }
+                madvise(ptr, sz, MADV_SEQUENTIAL);
+            }
+            close(fd);
+        }
+
+        ~mapped_file() {
+            if (ptr != nullptr) {
+                munmap(ptr, sz);
+            }
+        }
+
+        mapped_file(const mapped_file &) = delete;
+        mapped_file &operator=(const mapped_file &) = delete;
+
+        const char *data() const { return (const char *) ptr; }
+        size_t size() const { return sz; }
+
+    private:
+        void *ptr;
+        size_t sz;
+    };
+
+    /**
+     * Drops the pages of a file mapping that hold [from, from + bytes), but the last partial one,
+     * so that streaming through a large mapping keeps only a window of it in memory.
+     * Dropped pages are read from the file again if they are touched later.
+     */
+    inline void drop_pages(const void *from, size_t bytes) {
+        const uintptr_t page_sz = (uintptr_t) sysconf(_SC_PAGESIZE);
+        uintptr_t begin = (uintptr_t) from / page_sz * page_sz;
+        uintptr_t end = ((uintptr_t) from + bytes) / page_sz * page_sz;
+        if (begin < end) {
+            madvise((void *) begin, end - begin, MADV_DONTNEED);
+        }
+    }
+
+    // records of a mapped file one by one, views point straight into the mapping
+    class reader {
+    public:
+        explicit reader(const std::string &path) : path(path), file(path), offset(0) {}
+
+        // false at the end of the file; a broken or truncated record throws binary_io::error
+        bool next(array_view &array) {
+            const size_t fixed_header_sz = sizeof(MAGIC) + 3 * sizeof(uint32_t);
+            if (offset == file.size()) {
+                return false;
+            }
+            if (fixed_header_sz > file.size() - offset) {
+                throw error(path + ": truncated binary record");
+            }
+
+            const char *header = file.data() + offset;
+            if (std::memcmp(header, MAGIC, sizeof(MAGIC)) != 0) {
+                throw error(path + ": broken binary record");
+            }
+            uint32_t type;
+            uint32_t rank;
+            std::memcpy(&type, header + sizeof(MAGIC), sizeof(type));
+            std::memcpy(&rank, header + sizeof(MAGIC) + sizeof(type), sizeof(rank));
+            offset += fixed_header_sz;
+            if (!is_dtype(type)) {
+                throw error(path + ": unknown dtype " + std::to_string(type));
+            }
+
+            // sizes are compared with what is left of the file, so that no sum or product wraps around
+            if (rank > (file.size() - offset) / sizeof(uint64_t)) {
+                throw error(path + ": truncated binary record");
+            }
+            array.type = (dtype) type;
+            array.dims.resize(rank);
+            std::memcpy(array.dims.data(), file.data() + offset, rank * sizeof(uint64_t));
+            offset += rank * sizeof(uint64_t);
+
+            size_t count = 1;
+            for (auto dim : array.dims) {
+                if (dim != 0 && count > std::numeric_limits<size_t>::max() / dim) {
+                    throw error(path + ": binary record is too large");
+                }
+                count *= (size_t) dim;
+            }
+            if (count > (file.size() - offset) / dtype_size(array.type)) {
+                throw error(path + ": truncated binary record");
+            }
+            size_t bytes = count * dtype_size(array.type);
+            array.data = file.data() + offset;
+            // the padding of the last record may be missing
+            offset = std::min(file.size(), offset + (bytes + 7) / 8 * 8);
+            return true;
+        }
+
+    private:
+        std::string path;
+        mapped_file file;
+        size_t offset;
+    };
+
+    /**
+     * A file of one record whose values are written through a shared mapping, for outputs too large
+     * to be kept in memory: pages can be dropped with drop_pages once they are written.
+     */
+    class mapped_output {
+    public:
+        mapped_output(const std::string &path, dtype type, const std::vector<uint64_t> &dims) : ptr(nullptr) {
+            uint32_t fields[] = {(uint32_t) type, (uint32_t) dims.size(), 0};
+            header_sz = sizeof(MAGIC) + sizeof(fields) + dims.size() * sizeof(uint64_t);
+            array_view array = {type, dims, nullptr};
+            sz = header_sz + (array.count() * dtype_size(type) + 7) / 8 * 8;
+
+            int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                throw error("Could not open " + path);
+            }
+            if (ftruncate(fd, (off_t) sz) != 0) {
+                close(fd);
+                throw error("Could not resize " + path);
+            }
+            ptr = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (ptr == MAP_FAILED) {
+                throw error("Could not map " + path);
+            }
+
+            char *header = (char *) ptr;
+            std::memcpy(header, MAGIC, sizeof(MAGIC));
+            std::memcpy(header + sizeof(MAGIC), fields, sizeof(fields));
+            std::memcpy(header + sizeof(MAGIC) + sizeof(fields), dims.data(), dims.size() * sizeof(uint64_t));
+        }
+
+        ~mapped_output() {
+            munmap(ptr, sz);
+        }
+
+        mapped_output(const mapped_output &) = delete;
+        mapped_output &operator=(const mapped_output &) = delete;
+
+        // the values, aligned to 8 bytes
+        void *data() { return (char *) ptr + header_sz; }
+
+    private:
+        void *ptr;
+        size_t sz;
+        size_t header_sz;
+    };
+
+    // appends records to a file with one large write per record
+    class writer {
+    public:
+        explicit writer(const std::string &path) : path(path) {
+            fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                throw error("Could not open " + path);
+            }
+        }
+
+        ~writer() {
+            close(fd);
+        }
+
+        writer(const writer &) = delete;
+        writer &operator=(const writer &) = delete;
+
+        void write(dtype type, const std::vector<uint64_t> &dims, const void *data) {
+            uint32_t fields[] = {(uint32_t) type, (uint32_t) dims.size(), 0};
+            std::vector<char> header(sizeof(MAGIC) + sizeof(fields) + dims.size() * sizeof(uint64_t));
+            std::memcpy(header.data(), MAGIC, sizeof(MAGIC));
+            std::memcpy(header.data() + sizeof(MAGIC), fields, sizeof(fields));
+            std::memcpy(header.data() + sizeof(MAGIC) + sizeof(fields), dims.data(), dims.size() * sizeof(uint64_t));
+            write_all(header.data(), header.size());
+
+            array_view array = {type, dims, data};
+            size_t bytes = array.count() * dtype_size(type);
+            write_all(data, bytes);
+
+            const char padding[8] = {0};
+            write_all(padding, (8 - bytes % 8) % 8);
+        }
+
+    private:
+        void write_all(const void *data, size_t bytes) {
+            const char *ptr = (const char *) data;
+            while (bytes != 0) {
+                auto written = ::write(fd, ptr, bytes);
+                if (written <= 0) {
+                    throw error("Could not write " + path);
+                }
+                ptr += written;
+                bytes -= (size_t) written;
+            }
+        }
+
+        std::string path;
+        int fd;
+    };
+}
+
+
+#endif //AU_PARALLEL_COMPUTING_BINARY_IO_H
@@ -0,0 +1,11 @@
+# Embeds a text file into a header as a string constant, so that executables do not read it at run time:
+#     cmake -DINPUT=kernel.cl -DOUTPUT=kernel.cl.h -DNAME=kernel_source -P embed_source.cmake
+# defines `const char *const kernel_source`.
+
+file(READ ${INPUT} CONTENT)
+get_filename_component(INPUT_NAME ${INPUT} NAME)
+file(WRITE ${OUTPUT}.tmp "// generated from ${INPUT_NAME}, do not edit\n"
+        "static const char *const ${NAME} = R\"embedded_source(${CONTENT})embedded_source\";\n")
+# the header is rewritten only if the source changed, so dependent files are not rebuilt for nothing
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${OUTPUT}.tmp ${OUTPUT})
+file(REMOVE ${OUTPUT}.tmp)
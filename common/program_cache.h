@@ -0,0 +1,228 @@
+#ifndef AU_PARALLEL_COMPUTING_PROGRAM_CACHE_H
+#define AU_PARALLEL_COMPUTING_PROGRAM_CACHE_H
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/opencl.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * On-disk cache of built OpenCL programs shared by the labs, so that a process start does not
+ * compile the kernels again.
+ *
+ * A program is stored as CL_PROGRAM_BINARIES of its device in a file named by a hash of the key:
+ * the source, the build options, the platform, the device and the driver version. The file starts
+ * with the whole key, so a hash collision is a miss. Anything that fails while loading a binary falls
+ * back to compiling the source, which then replaces the file.
+ *
+ * The directory is $AU_CL_CACHE, then $XDG_CACHE_HOME/au-parallel-computing, then
+ * ~/.cache/au-parallel-computing. AU_CL_CACHE=off disables the cache.
+ */
+namespace program_cache {
+    const char MAGIC[4] = {'A', 'U', 'C', 'L'};
+
+    inline std::string device_string(cl_device_id device, cl_device_info param) {
+        size_t size = 0;
+        if (clGetDeviceInfo(device, param, 0, nullptr, &size) != CL_SUCCESS) {
+            return "";
+        }
+        std::string value(size, 0);
+        clGetDeviceInfo(device, param, size, &value[0], nullptr);
+        return value;
+    }
+
+    inline std::string platform_string(cl_platform_id platform, cl_platform_info param) {
+        size_t size = 0;
+        if (clGetPlatformInfo(platform, param, 0, nullptr, &size) != CL_SUCCESS) {
+            return "";
+        }
+        std::string value(size, 0);
+        clGetPlatformInfo(platform, param, size, &value[0], nullptr);
+        return value;
+    }
+
+    // everything the binary depends on
+    inline std::string program_key(cl_device_id device, const std::string &source, const std::string &options) {
+        cl_platform_id platform = nullptr;
+        clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, nullptr);
+        return platform_string(platform, CL_PLATFORM_NAME) + "\n" + platform_string(platform, CL_PLATFORM_VERSION) +
+               "\n" + device_string(device, CL_DEVICE_NAME) + "\n" + device_string(device, CL_DEVICE_VERSION) +
+               "\n" + device_string(device, CL_DRIVER_VERSION) + "\n" + options + "\n" + source;
+    }
+
+    // 64-bit FNV-1a
+    inline uint64_t hash(const std::string &data) {
+        uint64_t result = 14695981039346656037ULL;
+        for (unsigned char c : data) {
+            result = (result ^ c) * 1099511628211ULL;
+        }
+        return result;
+    }
+
+    // empty if the cache is disabled
+    inline std::string directory() {
+        auto cache = std::getenv("AU_CL_CACHE");
+        if (cache != nullptr) {
+            return std::string(cache) == "off" ? "" : cache;
+        }
+        auto xdg_cache = std::getenv("XDG_CACHE_HOME");
+        if (xdg_cache != nullptr && *xdg_cache != 0) {
+            return std::string(xdg_cache) + "/au-parallel-computing";
+        }
+        auto home = std::getenv("HOME");
+        if (home != nullptr && *home != 0) {
+            return std::string(home) + "/.cache/au-parallel-computing";
+        }
+        return "";
+    }
+
+    // creates the directory and its parents, true if it exists afterwards
+    inline bool make_directories(const std::string &path) {
+        for (size_t end = path.find('/', 1); ; end = path.find('/', end + 1)) {
+            auto prefix = path.substr(0, end);
+            if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+                return false;
+            }
+            if (end == std::string::npos) {
+                return true;
+            }
+        }
+    }
+
+    inline std::string cache_file(const std::string &dir, const std::string &key) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long) hash(key));
+        return dir + "/" + name;
+    }
+
+    // binary stored for exactly this key, empty if there is none
+    inline std::vector<unsigned char> load_binary(const std::string &file, const std::string &key) {
+        std::ifstream in(file, std::ios::binary);
+        char magic[4];
+        uint64_t key_size = 0;
+        if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + 4, MAGIC) ||
+            !in.read((char *) &key_size, sizeof(key_size)) || key_size != key.size()) {
+            return {};
+        }
+        std::string stored_key(key_size, 0);
+        uint64_t binary_size = 0;
+        if (!in.read(&stored_key[0], key_size) || stored_key != key ||
+            !in.read((char *) &binary_size, sizeof(binary_size))) {
+            return {};
+        }
+        // the binary is the rest of the file, a corrupt size must not decide how much is allocated
+        auto position = in.tellg();
+        if (position < 0 || !in.seekg(0, std::ios::end) || in.tellg() - position != (std::streamoff) binary_size ||
+            !in.seekg(position)) {
+            return {};
+        }
+        std::vector<unsigned char> binary(binary_size);
+        if (!in.read((char *) binary.data(), binary_size)) {
+            return {};
+        }
+        return binary;
+    }
+
+    // written to a temporary file first, so that concurrent processes never see a partial file
+    inline void store_binary(const std::string &dir, const std::string &file, const std::string &key,
+                             const std::vector<unsigned char> &binary) {
+        if (!make_directories(dir)) {
+            return;
+        }
+        auto temp_file = file + ".tmp" + std::to_string(getpid());
+        {
+            std::ofstream out(temp_file, std::ios::binary);
+            uint64_t key_size = key.size();
+            uint64_t binary_size = binary.size();
+            out.write(MAGIC, sizeof(MAGIC));
+            out.write((const char *) &key_size, sizeof(key_size));
+            out.write(key.data(), key.size());
+            out.write((const char *) &binary_size, sizeof(binary_size));
+            out.write((const char *) binary.data(), binary.size());
+            if (!out) {
+                std::remove(temp_file.c_str());
+                return;
+            }
+        }
+        if (std::rename(temp_file.c_str(), file.c_str()) != 0) {
+            std::remove(temp_file.c_str());
+        }
+    }
+
+    // binary of a program built for a single device, empty if the driver does not give it out
+    inline std::vector<unsigned char> program_binary(cl_program program) {
+        size_t binary_size = 0;
+        if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(binary_size), &binary_size, nullptr) !=
+            CL_SUCCESS || binary_size == 0) {
+            return {};
+        }
+        std::vector<unsigned char> binary(binary_size);
+        unsigned char *binaries[] = {binary.data()};
+        if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaries), binaries, nullptr) != CL_SUCCESS) {
+            return {};
+        }
+        return binary;
+    }
+
+    /**
+     * Program of `source` built for `device` with `options`, like clCreateProgramWithSource followed by
+     * clBuildProgram: `status` is the build status, on failure the program is still returned for its build log.
+     */
+    inline cl_program build_program(cl_context context, cl_device_id device, const std::string &source,
+                                    const std::string &options, cl_int &status) {
+        auto dir = directory();
+        auto key = program_key(device, source, options);
+        auto file = dir.empty() ? "" : cache_file(dir, key);
+
+        if (!file.empty()) {
+            auto binary = load_binary(file, key);
+            if (!binary.empty()) {
+                const unsigned char *binaries[] = {binary.data()};
+                size_t size = binary.size();
+                cl_int binary_status;
+                auto program = clCreateProgramWithBinary(context, 1, &device, &size, binaries, &binary_status,
+                                                         &status);
+                if (status == CL_SUCCESS && binary_status == CL_SUCCESS) {
+                    status = clBuildProgram(program, 1, &device, options.c_str(), nullptr, nullptr);
+                    if (status == CL_SUCCESS) {
+                        return program;
+                    }
+                }
+                if (program != nullptr) {
+                    clReleaseProgram(program);
+                }
+            }
+        }
+
+        const char *sources[] = {source.c_str()};
+        size_t length = source.length();
+        auto program = clCreateProgramWithSource(context, 1, sources, &length, &status);
+        if (status != CL_SUCCESS) {
+            return program;
+        }
+        status = clBuildProgram(program, 1, &device, options.c_str(), nullptr, nullptr);
+        if (status == CL_SUCCESS && !file.empty()) {
+            auto binary = program_binary(program);
+            if (!binary.empty()) {
+                store_binary(dir, file, key, binary);
+            }
+        }
+        return program;
+    }
+}
+
+
+#endif //AU_PARALLEL_COMPUTING_PROGRAM_CACHE_H
@@ -0,0 +1,108 @@
+#include <tbb/task_scheduler_init.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark.h"
+
+#include "ImageProcessor.h"
+
+/**
+ * Images through the whole graph, as `flow-graph -n count -s size -l limit` with generated images.
+ * Images are generated and the graph is built outside of the timed part. Bytes are the pixels of the input
+ * images, items are images.
+ *
+ * Every case also checks that the pixels are not copied: allocations of exactly one image of pixels made while
+ * the graph runs must all be buffers the pixel pool created for the output images, anything else is a copy.
+ * Masks have a frame and index lists of the random images are far smaller than an image, neither is counted.
+ */
+namespace {
+    // allocations of exactly `counted_size` bytes, the size is the largest size_t when nothing is counted
+    std::atomic<size_t> counted_size(std::numeric_limits<size_t>::max());
+    std::atomic<size_t> counted_allocations(0);
+
+    const std::vector<long> SIZES = {256, 1024};
+    const std::vector<long> COUNTS = {16, 64};
+    const std::vector<long> LIMITS = {1, 4, 16};
+    const pixel_t PIXEL_TO_SEARCH = 128;
+
+    // one thread and all the hardware threads
+    std::vector<long> thread_counts() {
+        long hardware = std::max(1u, std::thread::hardware_concurrency());
+        if (hardware == 1) {
+            return {1};
+        }
+        return {1, hardware};
+    }
+
+    benchmark::function process_images(pipeline_config config) {
+        return [config](benchmark::state &state) {
+            size_t size = state.range(0);
+            size_t count = state.range(1);
+            size_t limit = state.range(2);
+            tbb::task_scheduler_init threads((int) state.range(3));
+
+            std::vector<image_ptr> images;
+            for (size_t i = 0; i < count; ++i) {
+                images.push_back(std::make_shared<const Image>(size, size));
+            }
+
+            // graphs are built and destroyed while the timer is paused
+            std::unique_ptr<ImageProcessor> processor;
+            while (state.keep_running()) {
+                state.pause_timing();
+                processor.reset();
+                processor.reset(new ImageProcessor(memory_source(images), PIXEL_TO_SEARCH, limit, "/dev/null", config));
+                counted_allocations = 0;
+                counted_size = size * size * sizeof(pixel_t);
+                state.resume_timing();
+                processor->process();
+                counted_size = std::numeric_limits<size_t>::max();
+
+                size_t allocations = counted_allocations;
+                size_t pooled = processor->get_pixel_pool_stats().created;
+                if (allocations != pooled) {
+                    state.fail(std::to_string(allocations) + " image allocations, " + std::to_string(pooled) +
+                               " of them by the pixel pool");
+                }
+            }
+            state.set_label("0 pixel copies");
+            state.set_bytes_processed((double) count * size * size * sizeof(pixel_t));
+            state.set_items_processed((double) count, "images");
+        };
+    }
+}
+
+void *operator new(size_t size) {
+    if (size == counted_size.load(std::memory_order_relaxed)) {
+        counted_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    void *ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+// not inlined, so that the compiler does not pair the free with a new expression
+__attribute__((noinline)) void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    ::operator delete(ptr);
+}
+
+int main(int argc, char **argv) {
+    std::vector<benchmark::range> ranges = {{"size", SIZES}, {"count", COUNTS}, {"limit", LIMITS},
+                                            {"threads", thread_counts()}};
+    benchmark::add("split", process_images(pipeline_config::split())).ranges(ranges);
+    benchmark::add("fused", process_images(pipeline_config::fused())).ranges(ranges);
+    return benchmark::run(argc, argv);
+}
@@ -0,0 +1,222 @@
+#include "AverageLog.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include "binary_io.h"
+
+namespace {
+    // records in flight before producers wait for the writer
+    const size_t QUEUE_SIZE = 1 << 14;
+
+    void write_all(int fd, const char *data, size_t bytes) {
+        while (bytes != 0) {
+            auto written = ::write(fd, data, bytes);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                throw binary_io::error(std::string("Could not write log: ") + std::strerror(errno));
+            }
+            data += written;
+            bytes -= (size_t) written;
+        }
+    }
+}
+
+template<class T>
+AverageLog::ring_queue<T>::ring_queue(size_t size) : cells(size), mask(size - 1), push_position(0) {
+    assert((size & mask) == 0 && "Queue size must be a power of two");
+    for (size_t i = 0; i < size; ++i) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<class T>
+void AverageLog::ring_queue<T>::push(const T &value) {
+    size_t position = push_position.load(std::memory_order_relaxed);
+    for (;;) {
+        cell &c = cells[position & mask];
+        size_t sequence = c.sequence.load(std::memory_order_acquire);
+        if (sequence == position) {
+            if (push_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                c.value = value;
+                c.sequence.store(position + 1, std::memory_order_release);
+                return;
+            }
+        } else {
+            // the ring is full (the cell is a lap behind) or another producer took the position
+            if (sequence < position) {
+                std::this_thread::yield();
+            }
+            position = push_position.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template<class T>
+bool AverageLog::ring_queue<T>::pop(T &value) {
+    cell &c = cells[pop_position & mask];
+    if (c.sequence.load(std::memory_order_acquire) != pop_position + 1) {
+        return false;
+    }
+    value = c.value;
+    c.sequence.store(pop_position + cells.size(), std::memory_order_release);
+    ++pop_position;
+    return true;
+}
+
+template<class T>
+bool AverageLog::ring_queue<T>::empty() const {
+    return cells[pop_position & mask].sequence.load(std::memory_order_acquire) != pop_position + 1;
+}
+
+AverageLog::AverageLog(const std::string &path, log_format format, log_order order)
+        : format(format), order(order), records(QUEUE_SIZE), input_ids(QUEUE_SIZE), closing(false),
+          writer_waiting(false) {
+    if (format == log_format::text) {
+        text_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (text_fd < 0) {
+            throw binary_io::error("Could not open " + path);
+        }
+    } else {
+        binary_writer.reset(new binary_io::writer(path));
+    }
+    writer = std::thread(&AverageLog::write_loop, this);
+}
+
+AverageLog::~AverageLog() {
+    // a failed write is reported by close only
+    stop();
+}
+
+void AverageLog::expect(size_t image_id) {
+    if (order == log_order::input) {
+        input_ids.push(image_id);
+    }
+}
+
+void AverageLog::add(size_t image_id, size_t average) {
+    records.push(record{image_id, average});
+    // pairs with the fence of wait_for_records: either the writer sees the record or this sees it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writer_waiting.load(std::memory_order_relaxed)) {
+        wake_writer();
+    }
+}
+
+void AverageLog::close() {
+    stop();
+    if (failure) {
+        auto error = failure;
+        failure = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void AverageLog::stop() {
+    if (!writer.joinable()) {
+        return;
+    }
+    closing.store(true, std::memory_order_release);
+    wake_writer();
+    writer.join();
+    if (text_fd >= 0) {
+        ::close(text_fd);
+    }
+    binary_writer.reset();
+}
+
+void AverageLog::write_loop() {
+    for (;;) {
+        // records added before close are in the queue once closing is seen
+        bool last = closing.load(std::memory_order_acquire);
+        bool collected = collect();
+        if (last && !collected) {
+            break;
+        }
+        if (!collected) {
+            wait_for_records();
+        }
+    }
+    assert(pending.empty() && "Some images of the input were not logged");
+    flush();
+}
+
+void AverageLog::wait_for_records() {
+    std::unique_lock<std::mutex> lock(wake_mutex);
+    writer_waiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // a producer that missed the flag pushed its record before the fence, and it is seen here
+    while (records.empty() && !closing.load(std::memory_order_acquire)) {
+        wake.wait(lock);
+    }
+    writer_waiting.store(false, std::memory_order_relaxed);
+}
+
+void AverageLog::wake_writer() {
+    // under the lock, so that the writer is either before its check of the queue or waiting
+    std::lock_guard<std::mutex> lock(wake_mutex);
+    wake.notify_one();
+}
+
+bool AverageLog::collect() {
+    bool collected = false;
+    record r;
+    while (records.pop(r)) {
+        collected = true;
+        if (order == log_order::completion) {
+            append(r);
+        } else {
+            pending[r.image_id] = r.average;
+        }
+    }
+
+    while (order == log_order::input) {
+        if (!next_id_known && !(next_id_known = input_ids.pop(next_id))) {
+            break;
+        }
+        auto found = pending.find(next_id);
+        if (found == pending.end()) {
+            break;
+        }
+        append(record{found->first, found->second});
+        pending.erase(found);
+        next_id_known = false;
+        collected = true;
+    }
+    return collected;
+}
+
+void AverageLog::append(const record &r) {
+    if (format == log_format::text) {
+        text_batch += std::to_string(r.average);
+        text_batch += '\n';
+        if (text_batch.size() >= BATCH_BYTES) {
+            flush();
+        }
+    } else {
+        binary_batch.push_back((int64_t) r.image_id);
+        binary_batch.push_back((int64_t) r.average);
+        if (binary_batch.size() * sizeof(int64_t) >= BATCH_BYTES) {
+            flush();
+        }
+    }
+}
+
+void AverageLog::flush() {
+    // after a failed write the records are dropped, the writer keeps taking them so that producers never wait
+    try {
+        if (!failure && !text_batch.empty()) {
+            write_all(text_fd, text_batch.data(), text_batch.size());
+        }
+        if (!failure && !binary_batch.empty()) {
+            binary_writer->write(binary_io::dtype::int64, {binary_batch.size() / 2, 2}, binary_batch.data());
+        }
+    } catch (const binary_io::error &) {
+        failure = std::current_exception();
+    }
+    text_batch.clear();
+    binary_batch.clear();
+}
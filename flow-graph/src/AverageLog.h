@@ -0,0 +1,137 @@
+#ifndef AU_PARALLEL_COMPUTING_AVERAGELOG_H
+#define AU_PARALLEL_COMPUTING_AVERAGELOG_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace binary_io {
+    class writer;
+}
+
+// text: an average per line; binary: binary_io records of int64 (image id, average) pairs
+enum class log_format {
+    text, binary
+};
+
+// averages in the order images finish, or in the order they come from the source
+enum class log_order {
+    completion, input
+};
+
+/**
+ * Log of image averages. Graph nodes only put a record into a lock-free queue, a dedicated
+ * thread formats the records and writes them in batches of BATCH_BYTES, so neither a lock
+ * nor a write is on the way of an image. The writer sleeps while the queue is empty, a producer
+ * takes a lock only to wake it.
+ */
+class AverageLog {
+public:
+    // throws binary_io::error if the log can not be opened
+    AverageLog(const std::string &path, log_format format, log_order order);
+
+    ~AverageLog();
+
+    AverageLog(const AverageLog &) = delete;
+
+    AverageLog &operator=(const AverageLog &) = delete;
+
+    // the next image of the input, called in input order by one thread; only an input ordered log needs it
+    void expect(size_t image_id);
+
+    // called by any thread
+    void add(size_t image_id, size_t average);
+
+    // writes everything added so far and stops the writer, throws binary_io::error if a write failed
+    void close();
+
+private:
+    static const size_t BATCH_BYTES = 1 << 16;
+
+    /**
+     * Bounded queue of many producers and one consumer: a ring of cells with sequence numbers.
+     * A producer claims a position with a CAS and publishes the cell by its sequence number,
+     * the consumer frees the cell for the producer one lap later. A producer waits only if the
+     * ring is full.
+     */
+    template<class T>
+    class ring_queue {
+    public:
+        explicit ring_queue(size_t size);
+
+        void push(const T &value);
+
+        // consumer only
+        bool pop(T &value);
+
+        // consumer only
+        bool empty() const;
+
+    private:
+        struct cell {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        std::vector<cell> cells;
+        size_t mask;
+        std::atomic<size_t> push_position;
+        size_t pop_position = 0;
+    };
+
+    struct record {
+        size_t image_id;
+        size_t average;
+    };
+
+    // joins the writer, close without reporting a failed write
+    void stop();
+
+    void write_loop();
+
+    // blocks the writer until a record is added or the log is closing
+    void wait_for_records();
+
+    // wakes the writer if it waits
+    void wake_writer();
+
+    // takes the records of the queue into the batch, returns false if there were none
+    bool collect();
+
+    void append(const record &r);
+
+    void flush();
+
+    log_format format;
+    log_order order;
+
+    ring_queue<record> records;
+    ring_queue<size_t> input_ids;
+    std::atomic<bool> closing;
+    std::atomic<bool> writer_waiting;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::thread writer;
+
+    // one of them is open, used by the writer thread only
+    int text_fd = -1;
+    std::unique_ptr<binary_io::writer> binary_writer;
+    // the first failed write, set by the writer thread and read after it is joined
+    std::exception_ptr failure;
+    std::string text_batch;
+    std::vector<int64_t> binary_batch;
+    // averages waiting for the images before them, by image id
+    std::unordered_map<size_t, size_t> pending;
+    size_t next_id = 0;
+    bool next_id_known = false;
+};
+
+
+#endif //AU_PARALLEL_COMPUTING_AVERAGELOG_H
@@ -0,0 +1,69 @@
+#include <cassert>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include "BorderInversion.h"
+#include "ImageScan.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+    const pixel_t SELECTED = std::numeric_limits<pixel_t>::max();
+
+    // row of the output from the image row and the mask rows above, at and below it (`stride` apart)
+    void invert_row(const pixel_t *in, const pixel_t *mask, size_t stride, size_t width, pixel_t *out) {
+        const pixel_t *up = mask - stride;
+        const pixel_t *down = mask + stride;
+        size_t x = 0;
+#if defined(__SSE2__)
+        for (; x + 16 <= width; x += 16) {
+            // mask columns are shifted by one, mask[x + 1] is the pixel x itself
+            __m128i border = _mm_or_si128(
+                    _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i *) (up + x)),
+                                              _mm_loadu_si128((const __m128i *) (up + x + 1))),
+                                 _mm_or_si128(_mm_loadu_si128((const __m128i *) (up + x + 2)),
+                                              _mm_loadu_si128((const __m128i *) (mask + x)))),
+                    _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i *) (mask + x + 2)),
+                                              _mm_loadu_si128((const __m128i *) (down + x))),
+                                 _mm_or_si128(_mm_loadu_si128((const __m128i *) (down + x + 1)),
+                                              _mm_loadu_si128((const __m128i *) (down + x + 2)))));
+            _mm_storeu_si128((__m128i *) (out + x),
+                             _mm_xor_si128(_mm_loadu_si128((const __m128i *) (in + x)), border));
+        }
+#endif
+        for (; x < width; ++x) {
+            pixel_t border = up[x] | up[x + 1] | up[x + 2] | mask[x] | mask[x + 2] |
+                             down[x] | down[x + 1] | down[x + 2];
+            out[x] = in[x] ^ border;
+        }
+    }
+}
+
+void invert_borders(const Image &image, const std::vector<const std::vector<size_t> *> &selections,
+                    Image &output, std::vector<pixel_t> &mask) {
+    const size_t width = image.get_width();
+    const size_t height = image.get_height();
+    assert(output.get_width() == width && output.get_height() == height);
+
+    // image with a zero frame, pixel (row, col) is at (row + 1) * stride + col + 1
+    const size_t stride = width + 2;
+    mask.assign(stride * (height + 2), 0);
+    for (auto selection : selections) {
+        for (auto index : *selection) {
+            mask[(index / width + 1) * stride + index % width + 1] = SELECTED;
+        }
+    }
+
+    const pixel_t *in = image.get_pixels().data();
+    pixel_t *out = output.get_pixels().data();
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, height, tile_rows(image)),
+                      [&](const tbb::blocked_range<size_t> &rows) {
+                          for (size_t row = rows.begin(); row < rows.end(); ++row) {
+                              invert_row(in + row * width, mask.data() + (row + 1) * stride, stride, width,
+                                         out + row * width);
+                          }
+                      });
+}
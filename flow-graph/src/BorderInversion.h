@@ -0,0 +1,23 @@
+#ifndef AU_PARALLEL_COMPUTING_BORDERINVERSION_H
+#define AU_PARALLEL_COMPUTING_BORDERINVERSION_H
+
+#include <vector>
+
+#include "Image.h"
+
+/**
+ * Writes `image` into `output` with the 8 neighbours of every selected pixel inverted.
+ * A pixel is inverted once even if it borders several selected pixels, a selected pixel
+ * itself is inverted only if it borders another one.
+ *
+ * Selected pixels are marked in a mask with a zero frame one pixel wide, so the pixels on
+ * the edges of the image have all 8 neighbours in the mask as well. Then every row of the
+ * output is the row of the image XOR-ed (x ^ 0xff == 255 - x) with the OR of the 8 shifted
+ * mask rows: no branches and no allocations per pixel, 16 pixels at a time with SSE2.
+ * Row tiles are processed in parallel like in ImageScan. `mask` is scratch, its capacity is reused.
+ */
+void invert_borders(const Image &image, const std::vector<const std::vector<size_t> *> &selections,
+                    Image &output, std::vector<pixel_t> &mask);
+
+
+#endif //AU_PARALLEL_COMPUTING_BORDERINVERSION_H
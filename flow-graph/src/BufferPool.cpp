@@ -0,0 +1,9 @@
+#include "BufferPool.h"
+
+std::shared_ptr<Image> make_pooled_image(const std::shared_ptr<pixel_pool> &pool, size_t id, size_t w, size_t h) {
+    Image *image = new Image(Image::from_buffer(id, w, h, pool->acquire()));
+    return std::shared_ptr<Image>(image, [pool](Image *image) {
+        pool->release(std::move(image->get_pixels()));
+        delete image;
+    });
+}
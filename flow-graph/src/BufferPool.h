@@ -0,0 +1,92 @@
+#ifndef AU_PARALLEL_COMPUTING_BUFFERPOOL_H
+#define AU_PARALLEL_COMPUTING_BUFFERPOOL_H
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Image.h"
+
+struct pool_stats {
+    // buffers allocated by the pool, all the others were recycled
+    size_t created;
+    size_t acquired;
+    size_t reused;
+    // the most buffers out of the pool at once
+    size_t peak_in_use;
+    // the most buffers the pool keeps, and buffers created while it already had that many
+    size_t capacity;
+    size_t over_capacity;
+};
+
+/**
+ * Free list of buffers that keep their capacity. The flow graph has at most `-l` images
+ * in flight, so once the first images have passed the pool stops allocating: every image
+ * takes buffers that a finished image has returned.
+ *
+ * At most `capacity` buffers exist at once, N+k of them for N images in flight and k more
+ * the owner allows. An acquire past the cap does not block, a worker waiting there could hold
+ * up the very images that would return buffers; it gets a new buffer that is freed on release
+ * instead of being kept, and is counted in over_capacity. So the pool never grows past the cap.
+ */
+template<class Buffer>
+class BufferPool {
+public:
+    explicit BufferPool(size_t capacity) {
+        stats.capacity = capacity;
+    }
+
+    // a recycled buffer, its contents and size are left from the last use
+    Buffer acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++stats.acquired;
+        stats.peak_in_use = std::max(stats.peak_in_use, ++in_use);
+        if (free_buffers.empty()) {
+            ++stats.created;
+            if (++buffers > stats.capacity) {
+                ++stats.over_capacity;
+            }
+            return Buffer();
+        }
+        ++stats.reused;
+        Buffer buffer = std::move(free_buffers.back());
+        free_buffers.pop_back();
+        return buffer;
+    }
+
+    void release(Buffer buffer) {
+        std::lock_guard<std::mutex> lock(mutex);
+        --in_use;
+        if (buffers > stats.capacity) {
+            // `buffer` is freed instead of kept
+            --buffers;
+            return;
+        }
+        free_buffers.push_back(std::move(buffer));
+    }
+
+    pool_stats get_stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::vector<Buffer> free_buffers;
+    size_t in_use = 0;
+    // in use and free
+    size_t buffers = 0;
+    pool_stats stats = {};
+};
+
+typedef BufferPool<std::vector<pixel_t> > pixel_pool;
+// index lists of the fused analysis; they are exactly sized by its histogram, so recycled lists
+// take the place of per-task arenas
+typedef BufferPool<std::vector<size_t> > index_pool;
+
+// image with unspecified pixels, its buffer goes back to `pool` with the last pointer to the image
+std::shared_ptr<Image> make_pooled_image(const std::shared_ptr<pixel_pool> &pool, size_t id, size_t w, size_t h);
+
+
+#endif //AU_PARALLEL_COMPUTING_BUFFERPOOL_H
@@ -4,31 +4,31 @@
 
 #include "Image.h"
 
-Image::Image(size_t w, size_t h) : id((size_t) rand()){
+#include <atomic>
+
+namespace {
+    // ids of generated images, unique so that the graph and the input ordered log can key by them
+    std::atomic<size_t> next_generated_id(0);
+}
+
+Image::Image(size_t w, size_t h) : id(next_generated_id++) {
     generate(w, h);
 }
 
-std::vector<Image::pos_t> Image::get_border(size_t pixel_index) const {
-    int x = (int) (pixel_index / width);
-    int y = (int) (pixel_index % width);
-    std::vector<pos_t> border = {{x - 1, y - 1}, {x, y - 1}, {x + 1, y - 1},
-                                 {x - 1, y},                 {x + 1, y},
-                                 {x - 1, y + 1}, {x, y + 1}, {x + 1, y + 1}
-    };
-    std::vector<pos_t> filtered_border;
-    auto is_valid_pos = [&](pos_t pos) {
-        return pos.first >= 0 && pos.first < height && pos.second >= 0 && pos.second < width;
-    };
-    std::copy_if(border.begin(), border.end(), std::back_inserter(filtered_border), is_valid_pos);
-    return filtered_border;
+Image::Image(size_t id, size_t w, size_t h, std::vector<pixel_t> pixels)
+        : id(id), width(w), height(h), pixels(std::move(pixels)) {}
+
+Image Image::from_buffer(size_t id, size_t w, size_t h, std::vector<pixel_t> buffer) {
+    buffer.resize(w * h);
+    return Image(id, w, h, std::move(buffer));
 }
 
 const std::vector<pixel_t> &Image::get_pixels() const {
     return pixels;
 }
 
-pixel_t Image::invert_pixel(pixel_t c) {
-    return std::numeric_limits<pixel_t>::max() - c;
+std::vector<pixel_t> &Image::get_pixels() {
+    return pixels;
 }
 
 pixel_t Image::get_pixel(pos_t pos) const {
@@ -51,3 +51,11 @@ void Image::generate(size_t w, size_t h) {
 size_t Image::get_id() const {
     return id;
 }
+
+size_t Image::get_width() const {
+    return width;
+}
+
+size_t Image::get_height() const {
+    return height;
+}
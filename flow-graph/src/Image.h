@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <iterator>
 #include <limits>
+#include <memory>
 
 typedef unsigned char pixel_t;
 
@@ -17,23 +18,40 @@ class Image {
 public:
     typedef std::pair<int, int> pos_t;
 
+    // random image, ids of these images are unique within the process
     Image(size_t w = 0, size_t h = 0);
 
-    std::vector<pos_t> get_border(size_t pixel_index) const;
+    // image of `w` x `h` pixels stored in `buffer`, pixels already in the buffer are kept
+    static Image from_buffer(size_t id, size_t w, size_t h, std::vector<pixel_t> buffer);
+
+    // pixels are never copied, images travel through the flow graph as image_ptr
+    Image(const Image &) = delete;
+
+    Image &operator=(const Image &) = delete;
+
+    Image(Image &&) = default;
+
+    Image &operator=(Image &&) = default;
 
     const std::vector<pixel_t> &get_pixels() const;
 
+    std::vector<pixel_t> &get_pixels();
+
     pixel_t get_pixel(pos_t pos) const;
 
     pixel_t get_pixel(size_t pos) const;
 
     void generate(size_t w, size_t h);
 
-    static pixel_t invert_pixel(pixel_t c);
-
     size_t get_id() const;
 
+    size_t get_width() const;
+
+    size_t get_height() const;
+
 private:
+    Image(size_t id, size_t w, size_t h, std::vector<pixel_t> pixels);
+
     size_t id;
 
     size_t width;
@@ -42,5 +60,7 @@ private:
 
 };
 
+typedef std::shared_ptr<const Image> image_ptr;
+
 
 #endif //AU_PARALLEL_COMPUTING_IMAGE_H
@@ -2,175 +2,172 @@
 // Created by antonpp on 16.01.17.
 //
 
+#include <map>
+#include <string>
+
+#include <tbb/task_arena.h>
+
 #include "ImageProcessor.h"
+#include "ImageScan.h"
+#include "BorderInversion.h"
 
-using namespace tbb::flow;
 using std::make_shared;
 using std::vector;
 
 namespace {
 
-    typedef std::pair<Image, vector<size_t> > f_node_result_t;
-    typedef tuple<f_node_result_t, f_node_result_t, f_node_result_t> first_stage_tuple;
-    typedef tuple<bool, bool> second_stage_tuple;
-
-    vector<size_t> get_indices(const Image &image, pixel_t pixel_value) {
-        vector<size_t> result;
-        for (size_t i = 0; i < image.get_pixels().size(); ++i) {
-            if (image.get_pixels()[i] == pixel_value) {
-                result.push_back(i);
-            }
-        }
+    // buffers a pool keeps for the images: `per_image` for each of the `image_parallel` images the limiter
+    // lets in, and for one more image per worker, whose limiter slot is back while its last pointer is not dropped
+    size_t pool_capacity(size_t per_image, size_t image_parallel) {
+        size_t threads = (size_t) std::max(tbb::this_task_arena::max_concurrency(), 1);
+        return per_image * (image_parallel + threads);
+    }
 
-        return result;
+    selection_ptr make_result(const image_ptr &image, vector<size_t> indices) {
+        return std::make_shared<const selected_pixels>(selected_pixels{image, std::move(indices)});
     }
 
-    void invert_border(const Image &image, size_t selected_pixel) {
-        const auto &border = image.get_border(selected_pixel);
-        for (auto index: border) {
-            Image::invert_pixel(image.get_pixel(index));
-            // some useful code here
-        }
+    // the indices go back to `pool` with the last pointer to the result
+    selection_ptr make_pooled_result(const std::shared_ptr<index_pool> &pool, const image_ptr &image,
+                                     vector<size_t> indices) {
+        return selection_ptr(new selected_pixels{image, std::move(indices)}, [pool](selected_pixels *result) {
+            pool->release(std::move(result->indices));
+            delete result;
+        });
     }
 
-    void invert_border(f_node_result_t image_pixels) {
-        for (auto index: image_pixels.second) {
-            invert_border(image_pixels.first, index);
-        }
+    selection_ptr make_result(const image_ptr &image, pixel_t pixel_value) {
+        return make_result(image, get_indices(*image, pixel_value));
     }
 
-    vector<pixel_t> get_selected_pixels(f_node_result_t holder) {
-        vector<pixel_t> result;
-        for (auto x : holder.second) {
-            result.push_back(holder.first.get_pixel(x));
+    size_t sum_selected_pixels(const selection_ptr &holder) {
+        size_t sum = 0;
+        for (auto x : holder->indices) {
+            sum += holder->image->get_pixel(x);
         }
-        return result;
+        return sum;
     }
 
-    size_t get_job_id(f_node_result_t node_result) {
-        return node_result.first.get_id();
+    template<class Body>
+    const Body &find_stage(const std::map<std::string, Body> &stages, const std::string &name) {
+        auto found = stages.find(name);
+        if (found == stages.end()) {
+            std::string known;
+            for (const auto &stage : stages) {
+                known += (known.empty() ? "" : ", ") + stage.first;
+            }
+            throw config_error("Unknown pipeline stage `" + name + "`, the stages are " + known);
+        }
+        return found->second;
     }
 }
 
-void ImageProcessor::process() {
+size_t ImageProcessor::process() {
     source_generation_node->activate();
     flow_graph.wait_for_all();
+    average_log.close();
+    return generated_images;
 }
 
-ImageProcessor::ImageProcessor(const vector<Image> &images,
-                               pixel_t pixel_value,
-                               size_t image_parallel,
-                               std::string log_fname)
-        : pixel_to_search(pixel_value), images(images), average_pixel_log(log_fname) {
-
-    auto source_f = [&](Image &image) {
-        image = this->images[generated_images++];
-        return generated_images < this->images.size();
-    };
+pool_stats ImageProcessor::get_pixel_pool_stats() const {
+    return pixel_buffers->get_stats();
+}
 
-    auto max_pixel_f = [](const Image &image) {
-        auto max = *std::max_element(image.get_pixels().begin(), image.get_pixels().end());
-        return std::make_pair(image, get_indices(image, max));
-    };
-    auto min_pixel_f = [](const Image &image) {
-        auto min = *std::min_element(image.get_pixels().begin(), image.get_pixels().end());
-        return std::make_pair(image, get_indices(image, min));
-    };
+pool_stats ImageProcessor::get_mask_pool_stats() const {
+    return mask_buffers->get_stats();
+}
 
-    auto search_pixel_f = [&](const Image &image) {
-        return std::make_pair(image, get_indices(image, pixel_to_search));
-    };
+pool_stats ImageProcessor::get_index_pool_stats() const {
+    return index_buffers->get_stats();
+}
 
-    auto invert_selected_f = [](const first_stage_tuple &tuple) {
-        invert_border(get<0>(tuple));
-        invert_border(get<1>(tuple));
-        invert_border(get<2>(tuple));
+Profiler &ImageProcessor::get_profiler() {
+    return profiler;
+}
 
+ImageProcessor::ImageProcessor(image_source source,
+                               pixel_t pixel_value,
+                               size_t image_parallel,
+                               std::string log_fname,
+                               const pipeline_config &config,
+                               log_format format,
+                               log_order order,
+                               bool profile)
+        : pixel_to_search(pixel_value), source(std::move(source)),
+          // a decoded input and an inverted output image, a mask, three index lists and the tile histograms
+          pixel_buffers(make_shared<pixel_pool>(pool_capacity(2, image_parallel))),
+          mask_buffers(make_shared<pixel_pool>(pool_capacity(1, image_parallel))),
+          index_buffers(make_shared<index_pool>(pool_capacity(4, image_parallel))),
+          average_log(log_fname, format, order), profiler(profile) {
+
+    // only loaders go through the limiter, images are decoded once they are let in
+    auto source_f = [&](image_loader &loader) {
+        if (!this->source(loader)) {
+            return false;
+        }
+        average_log.expect(loader.id);
+        generated_images++;
         return true;
     };
 
-    auto average_selected_f = [&](first_stage_tuple const &t) {
-
-        vector<pixel_t> selected_pixels;
-        auto image_with_selected_pixels = get<0>(t);
-        auto r = get_selected_pixels(image_with_selected_pixels);
-        std::copy(r.begin(), r.end(), std::back_inserter(selected_pixels));
-
-        image_with_selected_pixels = get<1>(t);
-        r = get_selected_pixels(image_with_selected_pixels);
-        std::copy(r.begin(), r.end(), std::back_inserter(selected_pixels));
+    auto load_f = [&](const image_loader &loader) {
+        return loader.load(pixel_buffers);
+    };
 
-        image_with_selected_pixels = get<2>(t);
-        r = get_selected_pixels(image_with_selected_pixels);
-        std::copy(r.begin(), r.end(), std::back_inserter(selected_pixels));
+    /* analysis stages */
 
-        size_t value = std::accumulate<vector<pixel_t>::iterator, size_t>(selected_pixels.begin(),
-                                                                          selected_pixels.end(), 0);
+    std::map<std::string, analysis_body> analyses;
+    analyses["max"] = [](const image_ptr &image, vector<selection_ptr> &selections) {
+        selections.push_back(make_result(image, max_pixel(*image)));
+    };
+    analyses["min"] = [](const image_ptr &image, vector<selection_ptr> &selections) {
+        selections.push_back(make_result(image, min_pixel(*image)));
+    };
+    analyses["search"] = [&](const image_ptr &image, vector<selection_ptr> &selections) {
+        selections.push_back(make_result(image, pixel_to_search));
+    };
+    // index lists, scratch and output images are recycled, so the steady state does not allocate buffers
+    analyses["fused"] = [&](const image_ptr &image, vector<selection_ptr> &selections) {
+        pixel_selection selection = {index_buffers->acquire(), index_buffers->acquire(), index_buffers->acquire(),
+                                     index_buffers->acquire()};
+        select_pixels(*image, pixel_to_search, selection);
+        index_buffers->release(std::move(selection.tile_histograms));
+        selections.push_back(make_pooled_result(index_buffers, image, std::move(selection.max_indices)));
+        selections.push_back(make_pooled_result(index_buffers, image, std::move(selection.search_indices)));
+        selections.push_back(make_pooled_result(index_buffers, image, std::move(selection.min_indices)));
+    };
 
-        average_pixel_log << (value / selected_pixels.size()) << std::endl;
+    /* consumer stages */
 
-        return true;
+    std::map<std::string, consumer_body> consumers;
+    consumers["invert_border"] = [&](const image_analysis &analysis) {
+        const Image &image = *analysis.image;
+        auto inverted = make_pooled_image(pixel_buffers, image.get_id(), image.get_width(), image.get_height());
+        // masks have a pool of their own, an image buffer taken for a mask would have to grow
+        auto mask = mask_buffers->acquire();
+        invert_borders(image, analysis.index_lists, *inverted, mask);
+        mask_buffers->release(std::move(mask));
     };
+    consumers["calc_average"] = [&](const image_analysis &analysis) {
+        size_t value = 0;
+        size_t selected_count = 0;
+        for (const auto &selection : analysis.selections) {
+            value += sum_selected_pixels(selection);
+            selected_count += selection->indices.size();
+        }
 
-    auto stub_continue = [](const second_stage_tuple &) { return continue_msg(); };
-
-    /* vertices */
-
-    // setup
-    source_generation_node = make_shared<source_node<Image> >(flow_graph, source_f, false);
-    auto limiter = make_shared<limiter_node<Image> >(flow_graph, image_parallel);
-    auto input_broadcast_node = make_shared<broadcast_node<Image> >(flow_graph);
-
-    // stage 1
-    auto max_node = make_shared<function_node<Image, f_node_result_t> >(flow_graph, serial, max_pixel_f);
-    auto min_node = make_shared<function_node<Image, f_node_result_t> >(flow_graph, serial, min_pixel_f);
-    auto search_node = make_shared<function_node<Image, f_node_result_t> >(flow_graph, serial, search_pixel_f);
-    auto first_stage_joiner_node = make_shared<join_node<first_stage_tuple, key_matching<size_t> > >(flow_graph,
-                                                                                                     get_job_id,
-                                                                                                     get_job_id,
-                                                                                                     get_job_id);
-    auto first_stage_broadcast_node = make_shared<broadcast_node<first_stage_tuple> >(flow_graph);
-
-    // stage 2
-    auto invert_border_node = make_shared<function_node<first_stage_tuple, bool> >(flow_graph, unlimited,
-                                                                                   invert_selected_f);
-    auto calc_average_node = make_shared<function_node<first_stage_tuple, bool> >(flow_graph, unlimited,
-                                                                                  average_selected_f);
-    auto second_stage_joiner_node = make_shared<join_node<second_stage_tuple> >(flow_graph);
-
-    // update limiter
-    auto decrement_limiter_node = make_shared<function_node<second_stage_tuple, continue_msg> >(flow_graph, unlimited,
-                                                                                                stub_continue);
-
-    /* edges */
-
-    // setup
-    make_edge(*source_generation_node, *limiter);
-    make_edge(*limiter, *input_broadcast_node);
-
-    // stage 1
-    make_edge(*input_broadcast_node, *max_node);
-    make_edge(*input_broadcast_node, *search_node);
-    make_edge(*input_broadcast_node, *min_node);
-    make_edge(*max_node, input_port<0>(*first_stage_joiner_node));
-    make_edge(*search_node, input_port<1>(*first_stage_joiner_node));
-    make_edge(*min_node, input_port<2>(*first_stage_joiner_node));
-    make_edge(*first_stage_joiner_node, *first_stage_broadcast_node);
-
-    // stage 2
-    make_edge(*first_stage_broadcast_node, *invert_border_node);
-    make_edge(*first_stage_broadcast_node, *calc_average_node);
-    make_edge(*invert_border_node, input_port<0>(*second_stage_joiner_node));
-    make_edge(*calc_average_node, input_port<1>(*second_stage_joiner_node));
-
-    // decrement
-    make_edge(*second_stage_joiner_node, *decrement_limiter_node);
-    make_edge(*decrement_limiter_node, limiter->decrement);
-
-    nodes = {
-            source_generation_node, limiter, input_broadcast_node, max_node, min_node, search_node,
-            first_stage_joiner_node, first_stage_broadcast_node, invert_border_node, calc_average_node,
-            second_stage_joiner_node, decrement_limiter_node
+        average_log.add(analysis.image->get_id(), value / selected_count);
     };
-}
 
+    PipelineBuilder builder;
+    for (const auto &stage : config.analyses) {
+        builder.add_analysis(stage.name, stage.concurrency, find_stage(analyses, stage.name));
+    }
+    for (const auto &stage : config.consumers) {
+        builder.add_consumer(stage.name, stage.concurrency, find_stage(consumers, stage.name));
+    }
+
+    auto graph = builder.build(flow_graph, source_f, load_f, image_parallel, profiler);
+    source_generation_node = graph.source;
+    nodes = graph.nodes;
+}
@@ -16,23 +16,50 @@
 #include <iostream>
 #include <memory>
 
+#include "AverageLog.h"
+#include "BufferPool.h"
 #include "Image.h"
+#include "ImageSource.h"
+#include "Pipeline.h"
+#include "Profiler.h"
 
 class ImageProcessor {
 public:
-    ImageProcessor(const std::vector<Image> &images, pixel_t pixel_value, size_t image_parallel,
-                   std::string log_fname);
+    // throws config_error if the config names a stage that does not exist,
+    // binary_io::error if the log can not be opened
+    ImageProcessor(image_source source, pixel_t pixel_value, size_t image_parallel,
+                   std::string log_fname, const pipeline_config &config = pipeline_config::split(),
+                   log_format format = log_format::text, log_order order = log_order::completion,
+                   bool profile = false);
 
-    void process();
+    // returns the number of processed images, once all of them are in the log;
+    // throws binary_io::error if the log could not be written
+    size_t process();
+
+    // buffers of input and output images
+    pool_stats get_pixel_pool_stats() const;
+
+    // scratch masks of the border inversion, they have a frame and are larger than the images
+    pool_stats get_mask_pool_stats() const;
+
+    // index lists of the fused analysis
+    pool_stats get_index_pool_stats() const;
+
+    // node and image timings, empty unless the processor profiles
+    Profiler &get_profiler();
 
 private:
     size_t generated_images = 0;
 
     pixel_t pixel_to_search;
-    std::vector<Image> images;
+    image_source source;
+    std::shared_ptr<pixel_pool> pixel_buffers;
+    std::shared_ptr<pixel_pool> mask_buffers;
+    std::shared_ptr<index_pool> index_buffers;
     tbb::flow::graph flow_graph;
-    std::ofstream average_pixel_log;
-    std::shared_ptr<tbb::flow::source_node<Image>> source_generation_node;
+    AverageLog average_log;
+    Profiler profiler;
+    std::shared_ptr<tbb::flow::source_node<image_loader>> source_generation_node;
 
     // we do not need those pointers, but we want to delay destructors call of graph nodes...
     std::vector<std::shared_ptr<tbb::flow::graph_node>> nodes;
@@ -0,0 +1,225 @@
+#include <array>
+#include <functional>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/task_arena.h>
+
+#include "ImageScan.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+    const size_t HISTOGRAM_SIZE = std::numeric_limits<pixel_t>::max() + 1;
+    // consecutive pixels go to different histograms, so that equal pixels do not wait for each other
+    const size_t HISTOGRAMS = 4;
+
+    // a task gets at least this many pixels
+    const size_t MIN_TILE_PIXELS = 1 << 18;
+    // and every thread gets about this many tiles to balance
+    const size_t TILES_PER_THREAD = 4;
+
+    typedef std::array<size_t, HISTOGRAM_SIZE> histogram_t;
+    typedef tbb::blocked_range<size_t> rows_range;
+
+    rows_range image_rows(const Image &image) {
+        return rows_range(0, image.get_height(), tile_rows(image));
+    }
+
+    // adds the histogram of pixels [from, to) to `histogram`
+    void build_histogram(const pixel_t *pixels, size_t from, size_t to, size_t *histogram) {
+        size_t histograms[HISTOGRAMS][HISTOGRAM_SIZE] = {};
+        size_t i = from;
+        for (; i + HISTOGRAMS <= to; i += HISTOGRAMS) {
+            for (size_t h = 0; h < HISTOGRAMS; ++h) {
+                ++histograms[h][pixels[i + h]];
+            }
+        }
+        for (; i < to; ++i) {
+            ++histograms[0][pixels[i]];
+        }
+
+        for (size_t value = 0; value < HISTOGRAM_SIZE; ++value) {
+            histogram[value] += histograms[0][value] + histograms[1][value] + histograms[2][value] +
+                                histograms[3][value];
+        }
+    }
+
+    // where the next index of every list is written
+    struct index_cursor {
+        size_t *max;
+        size_t *min;
+        size_t *search;
+    };
+
+    void write_if(size_t *&out, pixel_t value, pixel_t pixel, size_t index) {
+        if (pixel == value) {
+            *out++ = index;
+        }
+    }
+
+    void gather(const pixel_t *pixels, size_t from, size_t to, pixel_t max, pixel_t min, pixel_t pixel_value,
+                index_cursor &cursor) {
+        for (size_t i = from; i < to; ++i) {
+            write_if(cursor.max, max, pixels[i], i);
+            write_if(cursor.min, min, pixels[i], i);
+            write_if(cursor.search, pixel_value, pixels[i], i);
+        }
+    }
+
+    void gather_simd(const pixel_t *pixels, size_t from, size_t to, pixel_t max, pixel_t min, pixel_t pixel_value,
+                     index_cursor &cursor) {
+        size_t i = from;
+#if defined(__SSE2__)
+        const __m128i max16 = _mm_set1_epi8((char) max);
+        const __m128i min16 = _mm_set1_epi8((char) min);
+        const __m128i value16 = _mm_set1_epi8((char) pixel_value);
+        for (; i + 16 <= to; i += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *) (pixels + i));
+            __m128i matches = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, max16), _mm_cmpeq_epi8(block, min16)),
+                                           _mm_cmpeq_epi8(block, value16));
+            // most blocks have none of the three values
+            if (_mm_movemask_epi8(matches) != 0) {
+                gather(pixels, i, i + 16, max, min, pixel_value, cursor);
+            }
+        }
+#endif
+        gather(pixels, i, to, max, min, pixel_value, cursor);
+    }
+
+    void append(std::vector<size_t> &to, const std::vector<size_t> &from) {
+        to.insert(to.end(), from.begin(), from.end());
+    }
+
+    // parallel_reduce body, joins the indices of neighbouring ranges left to right, so the order is kept
+    class index_gatherer {
+    public:
+        index_gatherer(const Image &image, pixel_t pixel_value) : image(image), pixel_value(pixel_value) {}
+
+        index_gatherer(index_gatherer &other, tbb::split) : image(other.image), pixel_value(other.pixel_value) {}
+
+        void operator()(const rows_range &rows) {
+            const auto &pixels = image.get_pixels();
+            for (size_t i = rows.begin() * image.get_width(); i < rows.end() * image.get_width(); ++i) {
+                if (pixels[i] == pixel_value) {
+                    indices.push_back(i);
+                }
+            }
+        }
+
+        void join(const index_gatherer &right) {
+            append(indices, right.indices);
+        }
+
+        std::vector<size_t> indices;
+
+    private:
+        const Image &image;
+        pixel_t pixel_value;
+    };
+
+    // the largest pixel in the order of `compare`
+    template<class Compare>
+    pixel_t extreme_pixel(const Image &image, pixel_t identity, Compare compare) {
+        const auto &pixels = image.get_pixels();
+        const size_t width = image.get_width();
+        return tbb::parallel_reduce(image_rows(image), identity,
+                                    [&](const rows_range &rows, pixel_t result) {
+                                        auto from = pixels.begin() + rows.begin() * width;
+                                        auto to = pixels.begin() + rows.end() * width;
+                                        if (from != to) {
+                                            result = std::max(result, *std::max_element(from, to, compare), compare);
+                                        }
+                                        return result;
+                                    },
+                                    [&](pixel_t a, pixel_t b) { return std::max(a, b, compare); });
+    }
+}
+
+size_t tile_rows(const Image &image) {
+    const size_t width = std::max<size_t>(image.get_width(), 1);
+    const size_t threads = (size_t) std::max(tbb::this_task_arena::max_concurrency(), 1);
+    const size_t tile_pixels = std::max(MIN_TILE_PIXELS, image.get_pixels().size() / (threads * TILES_PER_THREAD));
+    return std::max<size_t>(tile_pixels / width, 1);
+}
+
+pixel_t max_pixel(const Image &image) {
+    return extreme_pixel(image, std::numeric_limits<pixel_t>::min(), std::less<pixel_t>());
+}
+
+pixel_t min_pixel(const Image &image) {
+    return extreme_pixel(image, std::numeric_limits<pixel_t>::max(), std::greater<pixel_t>());
+}
+
+std::vector<size_t> get_indices(const Image &image, pixel_t pixel_value) {
+    index_gatherer gatherer(image, pixel_value);
+    tbb::parallel_reduce(image_rows(image), gatherer);
+    return std::move(gatherer.indices);
+}
+
+void select_pixels(const Image &image, pixel_t pixel_value, pixel_selection &selection) {
+    const auto &pixels = image.get_pixels();
+    const size_t width = image.get_width();
+    if (pixels.empty()) {
+        selection.max_indices.clear();
+        selection.min_indices.clear();
+        selection.search_indices.clear();
+        return;
+    }
+
+    const size_t rows_per_tile = tile_rows(image);
+    const size_t tiles = (image.get_height() + rows_per_tile - 1) / rows_per_tile;
+    auto tile_begin = [&](size_t tile) { return std::min(image.get_height(), tile * rows_per_tile) * width; };
+
+    // histogram of every tile, then of the whole image
+    auto &histograms = selection.tile_histograms;
+    histograms.assign(tiles * HISTOGRAM_SIZE, 0);
+    tbb::parallel_for(size_t(0), tiles, [&](size_t tile) {
+        build_histogram(pixels.data(), tile_begin(tile), tile_begin(tile + 1), &histograms[tile * HISTOGRAM_SIZE]);
+    });
+    histogram_t histogram = {};
+    for (size_t tile = 0; tile < tiles; ++tile) {
+        for (size_t value = 0; value < HISTOGRAM_SIZE; ++value) {
+            histogram[value] += histograms[tile * HISTOGRAM_SIZE + value];
+        }
+    }
+
+    size_t min = 0;
+    while (histogram[min] == 0) {
+        ++min;
+    }
+    size_t max = HISTOGRAM_SIZE - 1;
+    while (histogram[max] == 0) {
+        --max;
+    }
+
+    // the lists have their exact sizes, a tile writes its indices after the indices of the tiles before it
+    selection.max_indices.resize(histogram[max]);
+    selection.min_indices.resize(histogram[min]);
+    selection.search_indices.resize(histogram[pixel_value]);
+    // counts of the three values in the tile histograms become offsets of the tiles in the lists
+    for (size_t value : {max, min, (size_t) pixel_value}) {
+        if ((value == min && min == max) || (value == pixel_value && (pixel_value == max || pixel_value == min))) {
+            continue;
+        }
+        size_t offset = 0;
+        for (size_t tile = 0; tile < tiles; ++tile) {
+            size_t &count = histograms[tile * HISTOGRAM_SIZE + value];
+            size_t tile_count = count;
+            count = offset;
+            offset += tile_count;
+        }
+    }
+
+    tbb::parallel_for(size_t(0), tiles, [&](size_t tile) {
+        const size_t *offsets = &histograms[tile * HISTOGRAM_SIZE];
+        index_cursor cursor = {selection.max_indices.data() + offsets[max],
+                               selection.min_indices.data() + offsets[min],
+                               selection.search_indices.data() + offsets[pixel_value]};
+        gather_simd(pixels.data(), tile_begin(tile), tile_begin(tile + 1), (pixel_t) max, (pixel_t) min, pixel_value,
+                    cursor);
+    });
+}
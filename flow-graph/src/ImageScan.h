@@ -0,0 +1,43 @@
+#ifndef AU_PARALLEL_COMPUTING_IMAGESCAN_H
+#define AU_PARALLEL_COMPUTING_IMAGESCAN_H
+
+#include <vector>
+
+#include "Image.h"
+
+/**
+ * Scans of image pixels for stage 1. Large images are split into tiles of whole rows
+ * that are processed as nested TBB tasks, so they share the worker threads with the flow
+ * graph instead of adding threads. Small images are a single tile and run inline.
+ */
+
+// rows of one tile: a tile is large enough to pay for a task, and there are enough tiles to balance the threads
+size_t tile_rows(const Image &image);
+
+pixel_t max_pixel(const Image &image);
+
+pixel_t min_pixel(const Image &image);
+
+// indices of the pixels equal to `pixel_value`, in increasing order
+std::vector<size_t> get_indices(const Image &image, pixel_t pixel_value);
+
+// indices of the brightest, the darkest and the searched pixels, in increasing order
+struct pixel_selection {
+    std::vector<size_t> max_indices;
+    std::vector<size_t> min_indices;
+    std::vector<size_t> search_indices;
+    // scratch of select_pixels: a histogram per tile
+    std::vector<size_t> tile_histograms;
+};
+
+/**
+ * Fused stage 1: the same indices as three separate max/min/search scans.
+ * One pass builds a histogram of every tile, their total gives min, max and the sizes of the index lists,
+ * and the tile histograms give where the indices of every tile start in the lists. Then one more pass
+ * compares 16 pixels at a time with the three values and the tiles write their indices straight into
+ * the lists. The vectors of `selection` are only resized, so recycled vectors are not reallocated.
+ */
+void select_pixels(const Image &image, pixel_t pixel_value, pixel_selection &selection);
+
+
+#endif //AU_PARALLEL_COMPUTING_IMAGESCAN_H
@@ -0,0 +1,246 @@
+#include "ImageSource.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+
+#include <dirent.h>
+
+#include "binary_io.h"
+
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+    typedef shared_ptr<const binary_io::mapped_file> file_ptr;
+
+    // pixels of an image inside a mapped file
+    struct encoded_image {
+        file_ptr file;
+        size_t offset;
+        size_t width;
+        size_t height;
+    };
+
+    bool is_space(char c) {
+        return std::isspace((unsigned char) c) != 0;
+    }
+
+    bool is_pgm(const binary_io::mapped_file &file) {
+        return file.size() >= 2 && file.data()[0] == 'P' && file.data()[1] == '5';
+    }
+
+    /**
+     * Input files come from the user: a broken image throws binary_io::error, the reader warns
+     * and goes on with the next file.
+     */
+
+    // number of a PGM header at `offset`, whitespace and comments before it are skipped
+    size_t read_header_value(const binary_io::mapped_file &file, size_t &offset) {
+        const char *data = file.data();
+        while (offset < file.size() && (is_space(data[offset]) || data[offset] == '#')) {
+            if (data[offset] == '#') {
+                while (offset < file.size() && data[offset] != '\n') {
+                    offset++;
+                }
+            } else {
+                offset++;
+            }
+        }
+        if (offset == file.size() || !std::isdigit((unsigned char) data[offset])) {
+            throw binary_io::error("malformed PGM header");
+        }
+
+        size_t value = 0;
+        while (offset < file.size() && std::isdigit((unsigned char) data[offset])) {
+            if (value > (std::numeric_limits<size_t>::max() - 9) / 10) {
+                throw binary_io::error("malformed PGM header");
+            }
+            value = value * 10 + (size_t) (data[offset++] - '0');
+        }
+        return value;
+    }
+
+    // reads the header at `offset` and moves `offset` to the first pixel
+    void read_pgm_header(const binary_io::mapped_file &file, size_t &offset, size_t &width, size_t &height) {
+        if (file.size() - offset < 2 || file.data()[offset] != 'P' || file.data()[offset + 1] != '5') {
+            throw binary_io::error("not a binary PGM image");
+        }
+        offset += 2;
+        width = read_header_value(file, offset);
+        height = read_header_value(file, offset);
+        size_t max_value = read_header_value(file, offset);
+        if (max_value == 0 || max_value > 255) {
+            throw binary_io::error("only 8-bit PGM images are supported");
+        }
+        // a single whitespace separates the header from the pixels
+        if (offset == file.size() || !is_space(file.data()[offset])) {
+            throw binary_io::error("malformed PGM header");
+        }
+        offset++;
+    }
+
+    // applies `advice` to the whole pages of the image pixels
+    void advise(const encoded_image &image, int advice) {
+        static const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+        size_t first = (image.offset + page_size - 1) / page_size * page_size;
+        size_t last = (image.offset + image.width * image.height) / page_size * page_size;
+        if (last > first) {
+            madvise(const_cast<char *>(image.file->data()) + first, last - first, advice);
+        }
+    }
+
+    /**
+     * Images of the files one by one, a file stays mapped while its images are decoded.
+     * A file that can not be mapped, a file that is neither PGM nor whole raw frames and the rest
+     * of a file after a broken image are skipped with a warning.
+     */
+    class file_reader {
+    public:
+        file_reader(vector<string> paths, size_t raw_size) : paths(std::move(paths)), raw_size(raw_size) {}
+
+        bool next(encoded_image &image) {
+            while (true) {
+                if (!next_file()) {
+                    return false;
+                }
+                try {
+                    read_image(image);
+                    return true;
+                } catch (const binary_io::error &e) {
+                    std::cerr << paths[next_path - 1] << ": " << e.what() << ", the rest of the file is skipped"
+                              << std::endl;
+                    file.reset();
+                }
+            }
+        }
+
+    private:
+        // maps the next file unless the current one has images left, false when the files are over
+        bool next_file() {
+            while (file == nullptr || offset == file->size()) {
+                file.reset();
+                if (next_path == paths.size()) {
+                    return false;
+                }
+                const string &path = paths[next_path++];
+                try {
+                    file = make_shared<const binary_io::mapped_file>(path);
+                } catch (const binary_io::error &e) {
+                    std::cerr << e.what() << ", skipped" << std::endl;
+                    continue;
+                }
+                offset = 0;
+                pgm = is_pgm(*file);
+                if (!pgm && (raw_size == 0 || file->size() % (raw_size * raw_size) != 0)) {
+                    std::cerr << path << ": neither a binary PGM image nor " << raw_size << "x" << raw_size
+                              << " raw frames, skipped" << std::endl;
+                    file.reset();
+                }
+            }
+            return true;
+        }
+
+        void read_image(encoded_image &image) {
+            image.file = file;
+            if (pgm) {
+                read_pgm_header(*file, offset, image.width, image.height);
+            } else {
+                image.width = image.height = raw_size;
+            }
+            if (image.width == 0 || image.height == 0) {
+                throw binary_io::error("empty image");
+            }
+            if (image.width > (file->size() - offset) / image.height) {
+                throw binary_io::error("truncated image");
+            }
+            image.offset = offset;
+            offset += image.width * image.height;
+
+            if (pgm) {
+                while (offset < file->size() && is_space(file->data()[offset])) {
+                    offset++;
+                }
+            }
+        }
+
+        vector<string> paths;
+        size_t raw_size;
+        size_t next_path = 0;
+
+        file_ptr file;
+        size_t offset = 0;
+        bool pgm = false;
+    };
+
+    // regular files of a directory sorted by name, or the path itself if it is not a directory
+    vector<string> list_files(const string &path) {
+        struct stat path_stat;
+        if (stat(path.c_str(), &path_stat) != 0) {
+            throw binary_io::error("Could not find " + path);
+        }
+        if (!S_ISDIR(path_stat.st_mode)) {
+            return {path};
+        }
+
+        vector<string> files;
+        DIR *dir = opendir(path.c_str());
+        if (dir == nullptr) {
+            throw binary_io::error("Could not open directory " + path);
+        }
+        while (dirent *entry = readdir(dir)) {
+            string file_path = path + "/" + entry->d_name;
+            struct stat file_stat;
+            if (stat(file_path.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
+                files.push_back(file_path);
+            }
+        }
+        closedir(dir);
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+}
+
+image_source memory_source(vector<image_ptr> images) {
+    auto shared_images = make_shared<const vector<image_ptr> >(std::move(images));
+    auto next = make_shared<size_t>(0);
+    return [shared_images, next](image_loader &loader) {
+        if (*next == shared_images->size()) {
+            return false;
+        }
+        image_ptr image = (*shared_images)[(*next)++];
+        loader.id = image->get_id();
+        loader.load = [image](const std::shared_ptr<pixel_pool> &) { return image; };
+        return true;
+    };
+}
+
+image_source file_source(const string &path, size_t raw_size) {
+    auto reader = make_shared<file_reader>(list_files(path), raw_size);
+    auto next_id = make_shared<size_t>(0);
+    return [reader, next_id](image_loader &loader) {
+        encoded_image image;
+        if (!reader->next(image)) {
+            return false;
+        }
+        // start reading the pixels while the image waits for a worker
+        advise(image, MADV_WILLNEED);
+
+        size_t id = (*next_id)++;
+        loader.id = id;
+        loader.load = [image, id](const std::shared_ptr<pixel_pool> &pool) {
+            auto decoded = make_pooled_image(pool, id, image.width, image.height);
+            std::memcpy(decoded->get_pixels().data(), image.file->data() + image.offset, image.width * image.height);
+            // the copy is all that is needed, keep the mapping from growing resident memory
+            advise(image, MADV_DONTNEED);
+            return image_ptr(decoded);
+        };
+        return true;
+    };
+}
@@ -0,0 +1,42 @@
+#ifndef AU_PARALLEL_COMPUTING_IMAGESOURCE_H
+#define AU_PARALLEL_COMPUTING_IMAGESOURCE_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "BufferPool.h"
+#include "Image.h"
+
+/**
+ * Inputs of the flow graph. The source node only hands out loaders, which are cheap,
+ * the pixels are decoded by a node after the limiter, on the worker threads. So an image
+ * takes memory only once the limiter lets it in, and at most about `-l` images are resident
+ * however large the input is.
+ */
+
+// an input image before it is decoded
+struct image_loader {
+    // id of the image, known before it is decoded
+    size_t id;
+    // decodes the image, into a buffer of the pool unless the image is in memory already
+    std::function<image_ptr(const std::shared_ptr<pixel_pool> &)> load;
+};
+
+// loader of the next input image, false when the input is over; called serially
+typedef std::function<bool(image_loader &)> image_source;
+
+// images already in memory
+image_source memory_source(std::vector<image_ptr> images);
+
+/**
+ * Binary 8-bit PGM (P5) images or raw `raw_size` x `raw_size` frames, from every regular file
+ * of a directory in name order, or from a single archive file. A file may hold any number of
+ * images one after another. Files are mapped, decoded pixels are dropped from the mapping.
+ * Files that are neither PGM nor whole raw frames and the rest of a file after a broken image
+ * are skipped with a warning, a path that can not be listed throws binary_io::error.
+ */
+image_source file_source(const std::string &path, size_t raw_size);
+
+
+#endif //AU_PARALLEL_COMPUTING_IMAGESOURCE_H
@@ -0,0 +1,244 @@
+#include "Pipeline.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+#include <tbb/concurrent_hash_map.h>
+
+using namespace tbb::flow;
+using std::make_shared;
+using std::shared_ptr;
+using std::vector;
+
+namespace {
+
+    // selections of one analysis stage
+    struct stage_result {
+        size_t stage;
+        image_ptr image;
+        vector<selection_ptr> selections;
+    };
+
+    typedef shared_ptr<const stage_result> stage_result_ptr;
+    typedef shared_ptr<const image_analysis> analysis_ptr;
+
+    typedef multifunction_node<stage_result_ptr, tuple<analysis_ptr> > analysis_join_node;
+    typedef multifunction_node<size_t, tuple<continue_msg> > consumer_join_node;
+
+    // stage results of the images some analyses are not done with
+    struct pending_analysis {
+        size_t remaining;
+        vector<vector<selection_ptr> > selections;
+    };
+
+    typedef tbb::concurrent_hash_map<size_t, pending_analysis> pending_analyses;
+    // consumers left per image
+    typedef tbb::concurrent_hash_map<size_t, size_t> pending_consumers;
+
+    const char *const STAGE_FORMAT = "a stage is `analysis|consumer name concurrency`, "
+                                     "concurrency is a positive number, `serial` or `unlimited`";
+
+    // false if the value is not a concurrency
+    bool parse_concurrency(const std::string &value, size_t &concurrency) {
+        if (value == "unlimited") {
+            concurrency = UNLIMITED;
+            return true;
+        }
+        if (value == "serial") {
+            concurrency = 1;
+            return true;
+        }
+        // 0 would be unlimited, it is spelled out instead
+        if (value.empty() || value.size() > 9 || value == std::string(value.size(), '0') ||
+            !std::all_of(value.begin(), value.end(), [](char c) { return std::isdigit((unsigned char) c) != 0; })) {
+            return false;
+        }
+        concurrency = std::stoul(value);
+        return true;
+    }
+
+    analysis_ptr make_analysis(const image_ptr &image, const vector<vector<selection_ptr> > &stage_selections) {
+        auto analysis = make_shared<image_analysis>();
+        analysis->image = image;
+        for (const auto &selections : stage_selections) {
+            for (const auto &selection : selections) {
+                analysis->selections.push_back(selection);
+                analysis->index_lists.push_back(&selection->indices);
+            }
+        }
+        return analysis;
+    }
+}
+
+pipeline_config pipeline_config::split() {
+    return pipeline_config{{{"max", 1}, {"search", 1}, {"min", 1}},
+                           {{"invert_border", UNLIMITED}, {"calc_average", UNLIMITED}}};
+}
+
+pipeline_config pipeline_config::fused() {
+    return pipeline_config{{{"fused", UNLIMITED}},
+                           {{"invert_border", UNLIMITED}, {"calc_average", UNLIMITED}}};
+}
+
+pipeline_config pipeline_config::from_file(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw config_error("Could not open pipeline config " + path);
+    }
+
+    pipeline_config config;
+    std::string line;
+    for (size_t line_number = 1; std::getline(in, line); ++line_number) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string kind, name, concurrency, extra;
+        if (!(fields >> kind)) {
+            continue;
+        }
+        fields >> name >> concurrency >> extra;
+        stage_spec spec = {name, 0};
+        if ((kind != "analysis" && kind != "consumer") || name.empty() || !extra.empty() ||
+            !parse_concurrency(concurrency, spec.concurrency)) {
+            throw config_error(path + ":" + std::to_string(line_number) + ": " + STAGE_FORMAT);
+        }
+        (kind == "analysis" ? config.analyses : config.consumers).push_back(spec);
+    }
+    if (in.bad()) {
+        throw config_error("Could not read pipeline config " + path);
+    }
+    if (config.analyses.empty() || config.consumers.empty()) {
+        throw config_error(path + ": a pipeline needs an analysis and a consumer");
+    }
+    return config;
+}
+
+PipelineBuilder &PipelineBuilder::add_analysis(const std::string &name, size_t concurrency, analysis_body body) {
+    analyses.push_back(stage<analysis_body>{name, concurrency, std::move(body)});
+    return *this;
+}
+
+PipelineBuilder &PipelineBuilder::add_consumer(const std::string &name, size_t concurrency, consumer_body body) {
+    consumers.push_back(stage<consumer_body>{name, concurrency, std::move(body)});
+    return *this;
+}
+
+pipeline PipelineBuilder::build(graph &graph, image_source source, std::function<image_ptr(const image_loader &)> load,
+                                size_t image_parallel, Profiler &profiler) const {
+    assert(!analyses.empty() && !consumers.empty());
+    pipeline result;
+
+    /* setup */
+
+    auto source_f = profiler.timed("source", [source, &profiler](image_loader &loader) {
+        if (!source(loader)) {
+            return false;
+        }
+        profiler.image_queued(loader.id);
+        return true;
+    });
+    auto load_f = profiler.timed("load", [load, &profiler](const image_loader &loader) {
+        profiler.image_admitted(loader.id);
+        return load(loader);
+    });
+
+    result.source = make_shared<source_node<image_loader> >(graph, source_f, false);
+    auto limiter = make_shared<limiter_node<image_loader> >(graph, image_parallel);
+    auto load_node = make_shared<function_node<image_loader, image_ptr> >(graph, unlimited, load_f);
+    auto input_broadcast_node = make_shared<broadcast_node<image_ptr> >(graph);
+    make_edge(*result.source, *limiter);
+    make_edge(*limiter, *load_node);
+    make_edge(*load_node, *input_broadcast_node);
+    result.nodes = {result.source, limiter, load_node, input_broadcast_node};
+
+    /* analyses, joined by image id */
+
+    const size_t analysis_count = analyses.size();
+    auto pending = make_shared<pending_analyses>();
+    auto analysis_join_f = [analysis_count, pending](const stage_result_ptr &selected,
+                                                     analysis_join_node::output_ports_type &ports) {
+        if (analysis_count == 1) {
+            get<0>(ports).try_put(make_analysis(selected->image, {selected->selections}));
+            return;
+        }
+
+        analysis_ptr analysis;
+        {
+            pending_analyses::accessor entry;
+            if (pending->insert(entry, selected->image->get_id())) {
+                entry->second.remaining = analysis_count;
+                entry->second.selections.resize(analysis_count);
+            }
+            entry->second.selections[selected->stage] = selected->selections;
+            if (--entry->second.remaining != 0) {
+                return;
+            }
+            analysis = make_analysis(selected->image, entry->second.selections);
+            pending->erase(entry);
+        }
+        get<0>(ports).try_put(analysis);
+    };
+    auto analysis_join = make_shared<analysis_join_node>(graph, unlimited, analysis_join_f);
+    auto analysis_broadcast_node = make_shared<broadcast_node<analysis_ptr> >(graph);
+    make_edge(output_port<0>(*analysis_join), *analysis_broadcast_node);
+    result.nodes.push_back(analysis_join);
+    result.nodes.push_back(analysis_broadcast_node);
+
+    for (size_t i = 0; i < analysis_count; ++i) {
+        analysis_body body = analyses[i].body;
+        auto analysis_f = profiler.timed(analyses[i].name, [i, body, &profiler](const image_ptr &image) {
+            auto selected = make_shared<stage_result>();
+            selected->stage = i;
+            selected->image = image;
+            body(image, selected->selections);
+            profiler.first_stage_done(image->get_id());
+            return stage_result_ptr(selected);
+        });
+        auto node = make_shared<function_node<image_ptr, stage_result_ptr> >(graph, analyses[i].concurrency,
+                                                                             analysis_f);
+        make_edge(*input_broadcast_node, *node);
+        make_edge(*node, *analysis_join);
+        result.nodes.push_back(node);
+    }
+
+    /* consumers, the limiter is decremented once all of them are done with an image */
+
+    const size_t consumer_count = consumers.size();
+    auto remaining = make_shared<pending_consumers>();
+    auto consumer_join_f = [consumer_count, remaining, &profiler](const size_t &image_id,
+                                                                  consumer_join_node::output_ports_type &ports) {
+        if (consumer_count != 1) {
+            pending_consumers::accessor entry;
+            if (remaining->insert(entry, image_id)) {
+                entry->second = consumer_count;
+            }
+            if (--entry->second != 0) {
+                return;
+            }
+            remaining->erase(entry);
+        }
+        profiler.image_done(image_id);
+        get<0>(ports).try_put(continue_msg());
+    };
+    auto consumer_join = make_shared<consumer_join_node>(graph, unlimited, consumer_join_f);
+    make_edge(output_port<0>(*consumer_join), limiter->decrement);
+    result.nodes.push_back(consumer_join);
+
+    for (const auto &consumer : consumers) {
+        consumer_body body = consumer.body;
+        auto consumer_f = profiler.timed(consumer.name, [body, &profiler](const analysis_ptr &analysis) {
+            size_t image_id = analysis->image->get_id();
+            profiler.second_stage_started(image_id);
+            body(*analysis);
+            return image_id;
+        });
+        auto node = make_shared<function_node<analysis_ptr, size_t> >(graph, consumer.concurrency, consumer_f);
+        make_edge(*analysis_broadcast_node, *node);
+        make_edge(*node, *consumer_join);
+        result.nodes.push_back(node);
+    }
+
+    return result;
+}
@@ -0,0 +1,109 @@
+#ifndef AU_PARALLEL_COMPUTING_PIPELINE_H
+#define AU_PARALLEL_COMPUTING_PIPELINE_H
+
+#include <tbb/flow_graph.h>
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Image.h"
+#include "ImageSource.h"
+#include "Profiler.h"
+
+// pixels selected by an analysis stage, shared by all consumer stages
+struct selected_pixels {
+    image_ptr image;
+    std::vector<size_t> indices;
+};
+
+typedef std::shared_ptr<const selected_pixels> selection_ptr;
+
+// selections of all the analysis stages for one image, in the order the stages were added
+struct image_analysis {
+    image_ptr image;
+    std::vector<selection_ptr> selections;
+    // indices of every selection
+    std::vector<const std::vector<size_t> *> index_lists;
+};
+
+// appends the selections of the image
+typedef std::function<void(const image_ptr &, std::vector<selection_ptr> &)> analysis_body;
+
+typedef std::function<void(const image_analysis &)> consumer_body;
+
+// concurrency of a stage node, tbb::flow::unlimited
+const size_t UNLIMITED = 0;
+
+struct stage_spec {
+    std::string name;
+    size_t concurrency;
+};
+
+// a pipeline config that can not be read or names a stage that does not exist
+class config_error : public std::runtime_error {
+public:
+    explicit config_error(const std::string &message) : std::runtime_error(message) {}
+};
+
+/**
+ * Stages of a pipeline by name. A config file has a stage per line, `#` starts a comment:
+ *
+ *     analysis max 1
+ *     analysis search serial
+ *     consumer invert_border unlimited
+ */
+struct pipeline_config {
+    std::vector<stage_spec> analyses;
+    std::vector<stage_spec> consumers;
+
+    // max, search and min nodes one image at a time each, both consumers unlimited
+    static pipeline_config split();
+
+    // one unlimited node selects all three lists in a pass, both consumers unlimited
+    static pipeline_config fused();
+
+    // throws config_error for a file that can not be read or a malformed line
+    static pipeline_config from_file(const std::string &path);
+};
+
+struct pipeline {
+    std::shared_ptr<tbb::flow::source_node<image_loader> > source;
+    // all the nodes, they have to live as long as the graph runs
+    std::vector<std::shared_ptr<tbb::flow::graph_node> > nodes;
+};
+
+/**
+ * Builds the graph
+ *
+ *     source -> limiter -> load -> analysis stages -> join by image id -> consumer stages -> join -> limiter
+ *
+ * Every analysis gets every image, the consumers get the selections of all the analyses, and
+ * the limiter lets the next image in once all the consumers are done with an image.
+ * Node bodies are timed by the profiler under the names of the stages.
+ */
+class PipelineBuilder {
+public:
+    PipelineBuilder &add_analysis(const std::string &name, size_t concurrency, analysis_body body);
+
+    PipelineBuilder &add_consumer(const std::string &name, size_t concurrency, consumer_body body);
+
+    pipeline build(tbb::flow::graph &graph, image_source source, std::function<image_ptr(const image_loader &)> load,
+                   size_t image_parallel, Profiler &profiler) const;
+
+private:
+    template<class Body>
+    struct stage {
+        std::string name;
+        size_t concurrency;
+        Body body;
+    };
+
+    std::vector<stage<analysis_body> > analyses;
+    std::vector<stage<consumer_body> > consumers;
+};
+
+
+#endif //AU_PARALLEL_COMPUTING_PIPELINE_H
@@ -0,0 +1,211 @@
+#include "Profiler.h"
+
+#include <iomanip>
+
+namespace {
+    const size_t SUB_BUCKETS = 8;
+    const size_t SUB_BUCKET_BITS = 3;
+
+    size_t bucket_of(uint64_t ns) {
+        if (ns < SUB_BUCKETS) {
+            return (size_t) ns;
+        }
+        size_t msb = 63 - (size_t) __builtin_clzll(ns);
+        size_t sub = (size_t) (ns >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+        return (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    // the smallest latency of which `quantile` of `count` latencies are not larger
+    double quantile_us(const std::vector<uint64_t> &buckets, uint64_t count, double quantile) {
+        if (count == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t) (quantile * (double) (count - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+            seen += buckets[bucket];
+            if (seen >= rank) {
+                return latency_histogram::bucket_value(bucket) / 1e3;
+            }
+        }
+        return latency_histogram::bucket_value(buckets.size() - 1) / 1e3;
+    }
+
+    void print_metrics_json(std::ostream &out, const std::deque<metric> &metrics) {
+        out << "[";
+        bool first = true;
+        for (const auto &m : metrics) {
+            auto s = m.summary();
+            out << (first ? "" : ", ") << "{\"name\": \"" << s.name << "\", \"count\": " << s.count
+                << ", \"total_s\": " << s.total_seconds << ", \"p50_us\": " << s.p50_us
+                << ", \"p99_us\": " << s.p99_us << "}";
+            first = false;
+        }
+        out << "]";
+    }
+
+    void print_table(std::ostream &out, const std::string &title, const std::deque<metric> &metrics) {
+        out << std::left << std::setw(16) << title << std::right << std::setw(10) << "count" << std::setw(12)
+            << "total s" << std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << std::endl;
+        for (const auto &m : metrics) {
+            auto s = m.summary();
+            out << std::left << std::setw(16) << s.name << std::right << std::setw(10) << s.count << std::setw(12)
+                << s.total_seconds << std::setw(12) << s.p50_us << std::setw(12) << s.p99_us << std::endl;
+        }
+    }
+}
+
+latency_histogram::latency_histogram() : total_ns(0) {
+    for (auto &bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void latency_histogram::add(uint64_t ns) {
+    auto &bucket = buckets[bucket_of(ns)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    total_ns.store(total_ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+}
+
+uint64_t latency_histogram::merge_into(std::vector<uint64_t> &result) const {
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+        result[bucket] += buckets[bucket].load(std::memory_order_relaxed);
+    }
+    return total_ns.load(std::memory_order_relaxed);
+}
+
+double latency_histogram::bucket_value(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return (double) bucket;
+    }
+    size_t shift = bucket / SUB_BUCKETS - 1;
+    double lowest = (double) ((SUB_BUCKETS + bucket % SUB_BUCKETS) << shift);
+    return lowest + (double) (1ull << shift) / 2;
+}
+
+metric_summary metric::summary() const {
+    std::vector<uint64_t> buckets(latency_histogram::BUCKETS, 0);
+    uint64_t total_ns = 0;
+    for (const auto &histogram : histograms) {
+        total_ns += histogram.merge_into(buckets);
+    }
+    uint64_t count = 0;
+    for (auto bucket : buckets) {
+        count += bucket;
+    }
+    return metric_summary{name, count, (double) total_ns / 1e9, quantile_us(buckets, count, 0.5),
+                          quantile_us(buckets, count, 0.99)};
+}
+
+Profiler::Profiler(bool enabled) : enabled(enabled), start(profile_clock::now()) {
+    if (enabled) {
+        limiter_wait = &add_metric(image_metrics, "limiter_wait");
+        join_wait = &add_metric(image_metrics, "join_wait");
+        end_to_end = &add_metric(image_metrics, "end_to_end");
+    }
+}
+
+Profiler::~Profiler() {
+    stop_reports();
+}
+
+metric &Profiler::add_metric(std::deque<metric> &metrics, const std::string &name) {
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    metrics.emplace_back(name);
+    return metrics.back();
+}
+
+void Profiler::image_queued(size_t image_id) {
+    if (!enabled) {
+        return;
+    }
+    trace_map::accessor trace;
+    traces.insert(trace, image_id);
+    trace->second = image_trace{profile_clock::now(), profile_clock::time_point(), false};
+}
+
+void Profiler::image_admitted(size_t image_id) {
+    if (!enabled) {
+        return;
+    }
+    trace_map::const_accessor trace;
+    if (traces.find(trace, image_id)) {
+        limiter_wait->add(trace->second.queued, profile_clock::now());
+    }
+}
+
+void Profiler::first_stage_done(size_t image_id) {
+    if (!enabled) {
+        return;
+    }
+    // the last of the stage 1 results is the one the join waits for
+    trace_map::accessor trace;
+    if (traces.find(trace, image_id)) {
+        trace->second.first_stage_done = profile_clock::now();
+    }
+}
+
+void Profiler::second_stage_started(size_t image_id) {
+    if (!enabled) {
+        return;
+    }
+    trace_map::accessor trace;
+    if (traces.find(trace, image_id) && !trace->second.second_stage_started) {
+        trace->second.second_stage_started = true;
+        join_wait->add(trace->second.first_stage_done, profile_clock::now());
+    }
+}
+
+void Profiler::image_done(size_t image_id) {
+    if (!enabled) {
+        return;
+    }
+    trace_map::accessor trace;
+    if (traces.find(trace, image_id)) {
+        end_to_end->add(trace->second.queued, profile_clock::now());
+        traces.erase(trace);
+    }
+}
+
+void Profiler::print_summary(std::ostream &out) const {
+    std::chrono::duration<double> elapsed = profile_clock::now() - start;
+    out << "Profile after " << elapsed.count() << "s" << std::endl;
+    print_table(out, "node", node_metrics);
+    print_table(out, "image", image_metrics);
+}
+
+void Profiler::print_json(std::ostream &out) const {
+    std::chrono::duration<double> elapsed = profile_clock::now() - start;
+    out << "{\"elapsed_s\": " << elapsed.count() << ", \"nodes\": ";
+    print_metrics_json(out, node_metrics);
+    out << ", \"images\": ";
+    print_metrics_json(out, image_metrics);
+    out << "}" << std::endl;
+}
+
+void Profiler::start_reports(std::ostream &out, double period) {
+    std::lock_guard<std::mutex> lock(reporter_mutex);
+    reporting = true;
+    reporter = std::thread([this, &out, period]() {
+        auto next = profile_clock::now();
+        std::unique_lock<std::mutex> lock(reporter_mutex);
+        for (;;) {
+            next += std::chrono::duration_cast<profile_clock::duration>(std::chrono::duration<double>(period));
+            if (reporter_wakeup.wait_until(lock, next, [this]() { return !reporting; })) {
+                return;
+            }
+            print_json(out);
+        }
+    });
+}
+
+void Profiler::stop_reports() {
+    {
+        std::lock_guard<std::mutex> lock(reporter_mutex);
+        reporting = false;
+    }
+    reporter_wakeup.notify_all();
+    if (reporter.joinable()) {
+        reporter.join();
+    }
+}
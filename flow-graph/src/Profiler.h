@@ -0,0 +1,170 @@
+#ifndef AU_PARALLEL_COMPUTING_PROFILER_H
+#define AU_PARALLEL_COMPUTING_PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <tbb/concurrent_hash_map.h>
+#include <tbb/enumerable_thread_specific.h>
+
+typedef std::chrono::steady_clock profile_clock;
+
+/**
+ * Latencies of one thread. A power of two of nanoseconds is split into 8 buckets,
+ * so a quantile is within about 6% of the real value. Only the owner thread writes,
+ * any thread may read, hence relaxed atomics without read-modify-write.
+ */
+class latency_histogram {
+public:
+    static const size_t BUCKETS = 62 * 8;
+
+    latency_histogram();
+
+    void add(uint64_t ns);
+
+    // adds the counts of this histogram to `buckets`, returns the total of the latencies
+    uint64_t merge_into(std::vector<uint64_t> &buckets) const;
+
+    // the middle of the latencies a bucket holds
+    static double bucket_value(size_t bucket);
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> total_ns;
+};
+
+struct metric_summary {
+    std::string name;
+    uint64_t count;
+    double total_seconds;
+    double p50_us;
+    double p99_us;
+};
+
+// latencies of one node body or of one interval in the life of an image, recorded by every thread separately
+class metric {
+public:
+    explicit metric(std::string name) : name(std::move(name)) {}
+
+    void add(uint64_t ns) {
+        histograms.local().add(ns);
+    }
+
+    void add(profile_clock::time_point from, profile_clock::time_point to) {
+        add((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+    }
+
+    metric_summary summary() const;
+
+private:
+    std::string name;
+    mutable tbb::enumerable_thread_specific<latency_histogram> histograms;
+};
+
+// node body that records its run time, calls the body only if there is no metric
+template<class Body>
+class timed_body {
+public:
+    timed_body(Body body, metric *node_metric) : body(std::move(body)), node_metric(node_metric) {}
+
+    template<class Input>
+    auto operator()(Input &&input) -> decltype(std::declval<Body &>()(std::forward<Input>(input))) {
+        if (node_metric == nullptr) {
+            return body(std::forward<Input>(input));
+        }
+        auto start = profile_clock::now();
+        auto result = body(std::forward<Input>(input));
+        node_metric->add(start, profile_clock::now());
+        return result;
+    }
+
+private:
+    Body body;
+    metric *node_metric;
+};
+
+/**
+ * Instrumentation of the flow graph: run times of the node bodies and, per image,
+ * how long it waits for the limiter (from the source to the load node), for the join
+ * (from the last stage 1 result to stage 2) and how long it is in the graph.
+ * A disabled profiler records nothing, its bodies only check a pointer.
+ */
+class Profiler {
+public:
+    explicit Profiler(bool enabled);
+
+    ~Profiler();
+
+    bool is_enabled() const {
+        return enabled;
+    }
+
+    template<class Body>
+    timed_body<Body> timed(const std::string &name, Body body) {
+        return timed_body<Body>(std::move(body), enabled ? &add_metric(node_metrics, name) : nullptr);
+    }
+
+    // events in the life of an image, in this order
+    void image_queued(size_t image_id);
+
+    void image_admitted(size_t image_id);
+
+    void first_stage_done(size_t image_id);
+
+    void second_stage_started(size_t image_id);
+
+    void image_done(size_t image_id);
+
+    // a table of the nodes and the intervals
+    void print_summary(std::ostream &out) const;
+
+    // the same as one line of JSON
+    void print_json(std::ostream &out) const;
+
+    // prints JSON every `period` seconds until stop_reports
+    void start_reports(std::ostream &out, double period);
+
+    void stop_reports();
+
+private:
+    struct image_trace {
+        profile_clock::time_point queued;
+        profile_clock::time_point first_stage_done;
+        bool second_stage_started;
+    };
+
+    typedef tbb::concurrent_hash_map<size_t, image_trace> trace_map;
+
+    metric &add_metric(std::deque<metric> &metrics, const std::string &name);
+
+    bool enabled;
+    profile_clock::time_point start;
+
+    // metrics are created before the graph runs and never move
+    std::mutex metrics_mutex;
+    std::deque<metric> node_metrics;
+    std::deque<metric> image_metrics;
+    metric *limiter_wait = nullptr;
+    metric *join_wait = nullptr;
+    metric *end_to_end = nullptr;
+
+    trace_map traces;
+
+    std::thread reporter;
+    std::mutex reporter_mutex;
+    std::condition_variable reporter_wakeup;
+    bool reporting = false;
+};
+
+
+#endif //AU_PARALLEL_COMPUTING_PROFILER_H
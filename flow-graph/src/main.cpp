@@ -1,5 +1,9 @@
 #include <iostream>
+#include <memory>
 #include <vector>
+#include <chrono>
+
+#include "binary_io.h"
 
 #include "ImageProcessor.h"
 
@@ -9,17 +13,41 @@ namespace {
         std::cout << " [-f filename] ";
         std::cout << " [-b value] ";
         std::cout << " [-l number] ";
+        std::cout << " [-i path] ";
+        std::cout << " [-n number] ";
+        std::cout << " [-s size] ";
+        std::cout << " [-S split|fused] ";
+        std::cout << " [-c config] ";
+        std::cout << " [-F text|binary] ";
+        std::cout << " [-O completion|input] ";
+        std::cout << " [-p off|summary|json] ";
+        std::cout << " [-P seconds] ";
         std::cout << std::endl << std::endl;
         std::cout << "OPTIONS\n";
         std::cout << "\t-f filename\t Use it to specify a path where program log with average values will be written (default `flow-graph.log`)." << std::endl;
         std::cout << "\t-b value\t Use it to set brightness value that will be searched in image (default `128`)." << std::endl;
         std::cout << "\t-l number\t This option sets number of images processed simultaneously (default `4`)." << std::endl;
+        std::cout << "\t-i path\t\t Read binary 8-bit PGM or raw images from a directory or a file of concatenated images instead of generating them." << std::endl;
+        std::cout << "\t-n number\t Number of generated images (default `100`)." << std::endl;
+        std::cout << "\t-s size\t\t Width and height of generated and raw images (default `512`)." << std::endl;
+        std::cout << "\t-S type\t\t Stage 1 as separate max/min/search nodes (`split`) or one `fused` pass (default `split`)." << std::endl;
+        std::cout << "\t-c config\t Take the analysis and consumer stages and their concurrency from a pipeline config file instead of `-S`." << std::endl;
+        std::cout << "\t-F format\t Log averages as `text` lines or as `binary` records of (image id, average) pairs (default `text`)." << std::endl;
+        std::cout << "\t-O order\t Log images in the order they finish (`completion`) or in the `input` order (default `completion`)." << std::endl;
+        std::cout << "\t-p mode\t\t Profile the graph nodes and print the timings at exit as a table (`summary`) or as `json` (default `off`)." << std::endl;
+        std::cout << "\t-P seconds\t Profile and print the timings as a line of JSON every given seconds while processing." << std::endl;
+    }
+
+    void print_pool_stats(const std::string &name, const pool_stats &stats) {
+        std::cout << name << ": " << stats.created << " allocated, " << stats.reused << " of " << stats.acquired
+                  << " reused, at most " << stats.peak_in_use << " in use, " << stats.over_capacity
+                  << " past the cap of " << stats.capacity << std::endl;
     }
 
-    std::vector<Image> create_images(size_t n) {
-        std::vector<Image> images;
+    std::vector<image_ptr> create_images(size_t n, size_t size) {
+        std::vector<image_ptr> images;
         for (size_t i = 0; i < n; ++i) {
-            images.push_back(Image(512, 512));
+            images.push_back(std::make_shared<const Image>(size, size));
         }
         return images;
     }
@@ -29,6 +57,14 @@ int main(int argc, char **argv) {
     int pixel_to_search = 128;
     size_t parallel_images = 4;
     std::string log_fname = "flow-graph.log";
+    std::string input_path;
+    size_t images_number = 100;
+    size_t image_size = 512;
+    pipeline_config config = pipeline_config::split();
+    log_format format = log_format::text;
+    log_order order = log_order::completion;
+    std::string profile_mode = "off";
+    double report_period = 0;
 
     for (int i = 1; i < argc; i += 2) {
         std::string flag = argv[i];
@@ -41,14 +77,89 @@ int main(int argc, char **argv) {
             pixel_to_search = std::stoi(argv[i + 1]);
         } else if (flag == "-l") {
             parallel_images = std::stoul(argv[i + 1]);
+        } else if (flag == "-i") {
+            input_path = argv[i + 1];
+        } else if (flag == "-n") {
+            images_number = std::stoul(argv[i + 1]);
+        } else if (flag == "-s") {
+            image_size = std::stoul(argv[i + 1]);
+        } else if (flag == "-S" && std::string(argv[i + 1]) == "split") {
+            config = pipeline_config::split();
+        } else if (flag == "-S" && std::string(argv[i + 1]) == "fused") {
+            config = pipeline_config::fused();
+        } else if (flag == "-c") {
+            try {
+                config = pipeline_config::from_file(argv[i + 1]);
+            } catch (const config_error &e) {
+                std::cerr << e.what() << std::endl;
+                exit(1);
+            }
+        } else if (flag == "-F" && std::string(argv[i + 1]) == "text") {
+            format = log_format::text;
+        } else if (flag == "-F" && std::string(argv[i + 1]) == "binary") {
+            format = log_format::binary;
+        } else if (flag == "-O" && std::string(argv[i + 1]) == "completion") {
+            order = log_order::completion;
+        } else if (flag == "-O" && std::string(argv[i + 1]) == "input") {
+            order = log_order::input;
+        } else if (flag == "-p" && (std::string(argv[i + 1]) == "off" || std::string(argv[i + 1]) == "summary" ||
+                                    std::string(argv[i + 1]) == "json")) {
+            profile_mode = argv[i + 1];
+        } else if (flag == "-P") {
+            report_period = std::stod(argv[i + 1]);
         } else {
             usage(argv[0]);
             exit(1);
         }
     }
 
-    ImageProcessor ip(create_images(100), (pixel_t) pixel_to_search, parallel_images, log_fname);
-    ip.process();
+    // generated images are created before, files are read by the graph and are timed with it
+    image_source source;
+    try {
+        source = input_path.empty() ? memory_source(create_images(images_number, image_size))
+                                    : file_source(input_path, image_size);
+    } catch (const binary_io::error &e) {
+        std::cerr << e.what() << std::endl;
+        exit(1);
+    }
+    std::unique_ptr<ImageProcessor> processor;
+    try {
+        processor.reset(new ImageProcessor(source, (pixel_t) pixel_to_search, parallel_images, log_fname, config,
+                                           format, order, profile_mode != "off" || report_period > 0));
+    } catch (const config_error &e) {
+        std::cerr << e.what() << std::endl;
+        exit(1);
+    } catch (const binary_io::error &e) {
+        std::cerr << e.what() << std::endl;
+        exit(1);
+    }
+    ImageProcessor &ip = *processor;
+    if (report_period > 0) {
+        ip.get_profiler().start_reports(std::cout, report_period);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    size_t processed;
+    try {
+        processed = ip.process();
+    } catch (const binary_io::error &e) {
+        ip.get_profiler().stop_reports();
+        std::cerr << e.what() << std::endl;
+        exit(1);
+    }
+    ip.get_profiler().stop_reports();
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    std::cout << "Processed " << processed << " images in " << seconds.count() << "s, "
+              << processed / seconds.count() << " images/s" << std::endl;
+    print_pool_stats("Pixel buffers", ip.get_pixel_pool_stats());
+    print_pool_stats("Mask buffers", ip.get_mask_pool_stats());
+    print_pool_stats("Index buffers", ip.get_index_pool_stats());
+
+    if (profile_mode == "summary") {
+        ip.get_profiler().print_summary(std::cout);
+    } else if (profile_mode == "json") {
+        ip.get_profiler().print_json(std::cout);
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+
+#include "convolution.h"
+#include "cpu_convolution.h"
+#include "fft_convolution.h"
+#ifdef HAVE_OPENCL
+#include "opencl_convolution.h"
+#endif
+
+/**
+ * Convolution throughput for n x n matrices and m x m filters. Bytes are the matrix read and the result
+ * written, items are result elements. OpenCL cases include the upload and the readback, as `convolution` does,
+ * and run on the device `convolution` would pick: `-d`, then $CONVOLUTION_DEVICE, then the best ranked one.
+ */
+namespace {
+    const std::vector<long> SIZES = {256, 512, 1024};
+    const std::vector<long> FILTER_SIZES = {3, 5, 9};
+    // where the FFT competes with direct convolution on the CPU
+    const std::vector<long> LARGE_FILTER_SIZES = {9, 31, 101};
+    // frames of a batch case
+    const size_t BATCH_FRAMES = 16;
+
+    floats random_matrix(size_t n) {
+        std::mt19937 generator(42);
+        std::uniform_real_distribution<float> distribution(-1, 1);
+        floats matrix(n * n);
+        for (auto &x : matrix) {
+            x = distribution(generator);
+        }
+        return matrix;
+    }
+
+    // rank-1, so that every kernel type computes the same result
+    floats binomial_filter(size_t m) {
+        floats row(m, 1);
+        for (size_t k = 1; k < m; k++) {
+            for (size_t i = k; i > 0; i--) {
+                row[i] += row[i - 1];
+            }
+        }
+        floats filter(m * m);
+        for (size_t i = 0; i < m; i++) {
+            for (size_t j = 0; j < m; j++) {
+                filter[i * m + j] = row[i] * row[j];
+            }
+        }
+        return filter;
+    }
+
+    // binomial for the sizes OpenCL takes, random for larger ones whose binomial coefficients overflow float
+    floats cpu_filter(size_t m) {
+        return m <= (size_t) FILTER_SIZES.back() ? binomial_filter(m) : random_matrix(m);
+    }
+
+    void set_processed(benchmark::state &state, size_t n, size_t frames) {
+        state.set_bytes_processed(2.0 * n * n * sizeof(float) * frames);
+        state.set_items_processed((double) n * n * frames, "elements");
+    }
+
+    void cpu_convolution(benchmark::state &state) {
+        size_t n = state.range(0);
+        size_t m = state.range(1);
+        auto matrix = random_matrix(n);
+        auto filter = cpu_filter(m);
+        floats result(n * n);
+
+        while (state.keep_running()) {
+            calculate_cpu(matrix.data(), filter, n, m, result.data());
+        }
+        set_processed(state, n, 1);
+    }
+
+    void cpu_fft_convolution(benchmark::state &state) {
+        size_t n = state.range(0);
+        size_t m = state.range(1);
+        auto matrix = random_matrix(n);
+        auto filter = cpu_filter(m);
+        floats result(n * n);
+
+        while (state.keep_running()) {
+            calculate_fft(matrix.data(), filter, n, n, m, result.data());
+        }
+        state.set_label(fft_preferred(n, n, m) ? "preferred" : "direct preferred");
+        set_processed(state, n, 1);
+    }
+
+#ifdef HAVE_OPENCL
+    benchmark::function opencl_convolution(kernel_type type) {
+        return [type](benchmark::state &state) {
+            if (!opencl_available()) {
+                state.skip("no OpenCL device");
+                return;
+            }
+            size_t n = state.range(0);
+            size_t m = state.range(1);
+            auto matrix = random_matrix(n);
+            auto filter = binomial_filter(m);
+
+            while (state.keep_running()) {
+                calculate_parallel(matrix.data(), filter, n, m, type, [](const float *) {});
+            }
+            set_processed(state, n, 1);
+        };
+    }
+
+    // frames of the same size streamed through the overlapped batch queues
+    void opencl_batch(benchmark::state &state) {
+        if (!opencl_available()) {
+            state.skip("no OpenCL device");
+            return;
+        }
+        size_t n = state.range(0);
+        size_t m = state.range(1);
+        auto matrix = random_matrix(n);
+        auto filter = binomial_filter(m);
+
+        while (state.keep_running()) {
+            size_t frames = 0;
+            frame_reader read_frame = [&](floats &frame) {
+                if (frames == BATCH_FRAMES) {
+                    return false;
+                }
+                frames++;
+                frame.assign(matrix.begin(), matrix.end());
+                return true;
+            };
+            calculate_parallel_batch(filter, n, m, kernel_type::automatic, read_frame, [](const floats &) {});
+        }
+        set_processed(state, n, BATCH_FRAMES);
+    }
+#endif
+}
+
+int main(int argc, char **argv) {
+    std::vector<benchmark::range> ranges = {{"n", SIZES}, {"m", FILTER_SIZES}};
+    benchmark::add("cpu", cpu_convolution).ranges(ranges);
+    benchmark::add("cpu_large", cpu_convolution).ranges({{"n", SIZES}, {"m", LARGE_FILTER_SIZES}});
+    benchmark::add("cpu_fft", cpu_fft_convolution).ranges({{"n", SIZES}, {"m", LARGE_FILTER_SIZES}});
+#ifdef HAVE_OPENCL
+    // `-d device` goes before the benchmark options
+    if (argc > 2 && std::string(argv[1]) == "-d") {
+        set_opencl_device(argv[2]);
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+    benchmark::add("opencl_naive", opencl_convolution(kernel_type::naive)).ranges(ranges);
+    benchmark::add("opencl_tiled", opencl_convolution(kernel_type::tiled)).ranges(ranges);
+    benchmark::add("opencl_separable", opencl_convolution(kernel_type::separable)).ranges(ranges);
+    benchmark::add("opencl_batch", opencl_batch).ranges(ranges);
+#endif
+    return benchmark::run(argc, argv);
+}
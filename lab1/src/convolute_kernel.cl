@@ -1,7 +1,91 @@
+#ifndef BLOCK_SIZE
+#define BLOCK_SIZE 32
+#endif
+
+// Side of the filter. Every program is built for one `-D M=...`, so the loops over the taps
+// have constant bounds and unroll completely.
+#ifndef M
+#define M 3
+#endif
+
+#define M2 (M / 2)
+
+// Neighbourhoods of all work-items of the group are inside the n x n matrix,
+// such groups take the paths without bounds checks, only groups at the border check.
+bool interior_group(unsigned n) {
+    int first_row = get_group_id(0) * BLOCK_SIZE - M2;
+    int first_col = get_group_id(1) * BLOCK_SIZE - M2;
+    return first_row >= 0 && first_col >= 0 &&
+           first_row + BLOCK_SIZE + M - 1 <= (int) n && first_col + BLOCK_SIZE + M - 1 <= (int) n;
+}
+
 __kernel void convolute(__global const float* a, unsigned n,
-                        __global const float* b, unsigned m,
+                        __global const float* b,
                         __global float* res) {
-    int m2 = m / 2;
+    int row = get_global_id(0);
+    int col = get_global_id(1);
+    float sum = 0;
+
+    if (interior_group(n)) {
+        #pragma unroll
+        for (int i = -M2; i <= M2; ++i) {
+            #pragma unroll
+            for (int j = -M2; j <= M2; ++j) {
+                sum += b[(i + M2) * M + j + M2] * a[(row + i) * n + col + j];
+            }
+        }
+        res[row * n + col] = sum;
+        return;
+    }
+
+    if (row >= (int) n || col >= (int) n) {
+        return;
+    }
+
+    for (int i = -M2; i <= M2; ++i) {
+        for (int j = -M2; j <= M2; ++j) {
+            if (row + i >= 0 && row + i < (int) n && col + j >= 0 && col + j < (int) n) {
+                sum += b[(i + M2) * M + j + M2] * a[(row + i) * n + col + j];
+            }
+        }
+    }
+
+    res[row * n + col] = sum;
+}
+
+// Same result as `convolute`, but every work-group first stages its
+// (BLOCK_SIZE + M - 1)^2 neighbourhood in local memory (zero outside of the matrix),
+// so each element of `a` is read from global memory about once per group and
+// the inner loop has no bounds checks. `tile` must hold (BLOCK_SIZE + M - 1)^2 floats.
+__kernel void convolute_tiled(__global const float* a, unsigned n,
+                              __constant float* b,
+                              __global float* res,
+                              __local float* tile) {
+    const int tile_sz = BLOCK_SIZE + M - 1;
+    int local_row = get_local_id(0);
+    int local_col = get_local_id(1);
+    int tile_row = get_group_id(0) * BLOCK_SIZE - M2;
+    int tile_col = get_group_id(1) * BLOCK_SIZE - M2;
+
+    if (interior_group(n)) {
+        for (int i = local_row; i < tile_sz; i += BLOCK_SIZE) {
+            for (int j = local_col; j < tile_sz; j += BLOCK_SIZE) {
+                tile[i * tile_sz + j] = a[(tile_row + i) * n + tile_col + j];
+            }
+        }
+    } else {
+        for (int i = local_row; i < tile_sz; i += BLOCK_SIZE) {
+            int row = tile_row + i;
+            for (int j = local_col; j < tile_sz; j += BLOCK_SIZE) {
+                int col = tile_col + j;
+                bool inside = row >= 0 && row < (int) n && col >= 0 && col < (int) n;
+                tile[i * tile_sz + j] = inside ? a[row * n + col] : 0;
+            }
+        }
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
     size_t row = get_global_id(0);
     size_t col = get_global_id(1);
 
@@ -10,13 +94,118 @@ __kernel void convolute(__global const float* a, unsigned n,
     }
 
     float sum = 0;
-    for (int i = -m2; i <= m2; ++i) {
-        for (int j = -m2; j <= m2; ++j) {
-            if (row + i >= 0 && row + i < n && col + j >= 0 && col + j < n) {
-                sum += b[(i + m2) * m + j + m2] * a[(row + i) * n + col + j];
-            }
+    #pragma unroll
+    for (int i = 0; i < M; ++i) {
+        #pragma unroll
+        for (int j = 0; j < M; ++j) {
+            sum += b[i * M + j] * tile[(local_row + i) * tile_sz + local_col + j];
+        }
+    }
+
+    res[row * n + col] = sum;
+}
+
+// First pass of a separable convolution: 1D convolution of every row with `row_filter`.
+__kernel void convolute_rows(__global const float* a, unsigned n,
+                             __constant float* row_filter,
+                             __global float* res) {
+    int row = get_global_id(0);
+    int col = get_global_id(1);
+    float sum = 0;
+
+    if (interior_group(n)) {
+        #pragma unroll
+        for (int j = -M2; j <= M2; ++j) {
+            sum += row_filter[j + M2] * a[row * n + col + j];
         }
+        res[row * n + col] = sum;
+        return;
+    }
+
+    if (row >= (int) n || col >= (int) n) {
+        return;
+    }
+
+    int from = max(-M2, -col);
+    int to = min(M2, (int) n - 1 - col);
+
+    for (int j = from; j <= to; ++j) {
+        sum += row_filter[j + M2] * a[row * n + col + j];
+    }
+
+    res[row * n + col] = sum;
+}
+
+// Second pass of a separable convolution: 1D convolution of every column with `col_filter`.
+__kernel void convolute_cols(__global const float* a, unsigned n,
+                             __constant float* col_filter,
+                             __global float* res) {
+    int row = get_global_id(0);
+    int col = get_global_id(1);
+    float sum = 0;
+
+    if (interior_group(n)) {
+        #pragma unroll
+        for (int i = -M2; i <= M2; ++i) {
+            sum += col_filter[i + M2] * a[(row + i) * n + col];
+        }
+        res[row * n + col] = sum;
+        return;
+    }
+
+    if (row >= (int) n || col >= (int) n) {
+        return;
+    }
+
+    int from = max(-M2, -row);
+    int to = min(M2, (int) n - 1 - row);
+
+    for (int i = from; i <= to; ++i) {
+        sum += col_filter[i + M2] * a[(row + i) * n + col];
     }
 
     res[row * n + col] = sum;
-}
\ No newline at end of file
+}
+
+// Convolution of one horizontal band of a larger matrix, `width` columns wide. Buffer row k of `a`
+// is the matrix row first_row - M2 + k, where `first_row` is the first row of the band, so output
+// row r of `res` reads buffer rows r..r + M - 1. Only buffer rows [valid_from, valid_to) hold matrix
+// rows, the rest are above or below the matrix and count as zero. Taps are summed in the order of
+// `convolute`, so a matrix convolved band by band gives the same result as a whole.
+__kernel void convolute_band(__global const float* a, unsigned width,
+                             unsigned valid_from, unsigned valid_to, unsigned rows,
+                             __constant float* b,
+                             __global float* res) {
+    int row = get_global_id(0);
+    int col = get_global_id(1);
+    float sum = 0;
+
+    int first_row = get_group_id(0) * BLOCK_SIZE;
+    int first_col = get_group_id(1) * BLOCK_SIZE - M2;
+    if (first_row >= (int) valid_from && first_row + BLOCK_SIZE + M - 1 <= (int) valid_to &&
+        first_col >= 0 && first_col + BLOCK_SIZE + M - 1 <= (int) width) {
+        #pragma unroll
+        for (int i = 0; i < M; ++i) {
+            #pragma unroll
+            for (int j = -M2; j <= M2; ++j) {
+                sum += b[i * M + j + M2] * a[(row + i) * width + col + j];
+            }
+        }
+        res[row * width + col] = sum;
+        return;
+    }
+
+    if (row >= (int) rows || col >= (int) width) {
+        return;
+    }
+
+    for (int i = 0; i < M; ++i) {
+        for (int j = -M2; j <= M2; ++j) {
+            if (row + i >= (int) valid_from && row + i < (int) valid_to && col + j >= 0 && col + j < (int) width) {
+                sum += b[i * M + j + M2] * a[(row + i) * width + col + j];
+            }
+        }
+    }
+
+    res[row * width + col] = sum;
+}
@@ -0,0 +1,51 @@
+#ifndef AU_PARALLEL_COMPUTING_CONVOLUTION_H
+#define AU_PARALLEL_COMPUTING_CONVOLUTION_H
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <functional>
+
+typedef std::vector<float> floats;
+
+// batch mode: reader fills the next n*n matrix and returns false when there are no more,
+// writer receives results in the same order
+typedef std::function<bool(floats &)> frame_reader;
+typedef std::function<void(const floats &)> frame_writer;
+
+// receives n*n result while it is still mapped from the device
+typedef std::function<void(const float *)> result_consumer;
+
+// out-of-core mode: rows [row_from, row_to) of the result are written, bands arrive in order
+typedef std::function<void(size_t row_from, size_t row_to)> band_consumer;
+
+struct batch_stats {
+    size_t frames;
+    double seconds;
+    // summed over frames, may overlap with each other in time
+    double transfer_seconds;
+    double compute_seconds;
+};
+
+enum class kernel_type {
+    automatic, // separable if the filter is rank-1, tiled otherwise
+    naive,     // every work-item reads its neighbourhood straight from global memory
+    tiled,     // work-group stages a halo tile in local memory, filter lives in constant memory
+    separable  // row pass followed by column pass, 2m instead of m^2 taps per element; tiled if not rank-1
+};
+
+inline kernel_type parse_kernel_type(const std::string &name) {
+    if (name == "auto") {
+        return kernel_type::automatic;
+    } else if (name == "naive") {
+        return kernel_type::naive;
+    } else if (name == "tiled") {
+        return kernel_type::tiled;
+    } else if (name == "separable") {
+        return kernel_type::separable;
+    }
+    throw std::invalid_argument("Unknown kernel: " + name);
+}
+
+
+#endif //AU_PARALLEL_COMPUTING_CONVOLUTION_H
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <thread>
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+#include "cpu_convolution.h"
+
+namespace {
+    // output columns processed at once: the block and the m input rows it reads stay in L1
+    const size_t COLUMN_BLOCK = 512;
+
+#if defined(__SSE__) && defined(__GNUC__)
+#define AVX_DISPATCH
+    // y += w * x eight elements at a time from i on, i is left at the first element that is not done
+    __attribute__((target("avx"))) void axpy_avx(float w, const float *x, float *y, size_t len, size_t &i) {
+        const __m256 w8 = _mm256_set1_ps(w);
+        for (; i + 8 <= len; i += 8) {
+            _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(w8, _mm256_loadu_ps(x + i))));
+        }
+    }
+#endif
+
+    // y[0..len) += w * x[0..len), the AVX loop is compiled into every build and taken on CPUs that have AVX
+    void axpy(float w, const float *x, float *y, size_t len) {
+        size_t i = 0;
+#ifdef AVX_DISPATCH
+        static const bool avx = __builtin_cpu_supports("avx");
+        if (avx) {
+            axpy_avx(w, x, y, len, i);
+        }
+#endif
+#if defined(__SSE__)
+        const __m128 w4 = _mm_set1_ps(w);
+        for (; i + 4 <= len; i += 4) {
+            _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(w4, _mm_loadu_ps(x + i))));
+        }
+#endif
+        for (; i < len; i++) {
+            y[i] += w * x[i];
+        }
+    }
+
+    void convolute_rows(const float *matrix, const floats &kernel, size_t height, size_t width, size_t m,
+                        size_t row_from, size_t row_to, float *result) {
+        const long m2 = m / 2;
+        for (size_t row = row_from; row < row_to; row++) {
+            float *out = &result[row * width];
+            for (size_t col_from = 0; col_from < width; col_from += COLUMN_BLOCK) {
+                const size_t col_to = std::min(width, col_from + COLUMN_BLOCK);
+                std::fill(out + col_from, out + col_to, 0.f);
+
+                for (long i = -m2; i <= m2; i++) {
+                    const long in_row = (long) row + i;
+                    if (in_row < 0 || in_row >= (long) height) {
+                        continue;
+                    }
+                    const float *in = &matrix[in_row * width];
+                    for (long j = -m2; j <= m2; j++) {
+                        // columns of the block whose neighbour col + j is inside the matrix
+                        const long from = std::max((long) col_from, -j);
+                        const long to = std::min((long) col_to, (long) width - j);
+                        if (from < to) {
+                            axpy(kernel[(i + m2) * m + j + m2], in + from + j, out + from, (size_t) (to - from));
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void calculate_cpu(const float *matrix, const floats &kernel, size_t n, size_t m, float *result) {
+    calculate_cpu_rows(matrix, kernel, n, n, m, 0, n, result);
+}
+
+void calculate_cpu_rows(const float *matrix, const floats &kernel, size_t height, size_t width, size_t m,
+                        size_t row_from, size_t row_to, float *result) {
+    const size_t rows = row_to - row_from;
+    size_t threads_num = std::max(1u, std::thread::hardware_concurrency());
+    threads_num = std::min(threads_num, std::max<size_t>(rows, 1));
+    const size_t rows_per_thread = (rows + threads_num - 1) / threads_num;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < threads_num; t++) {
+        const size_t from = std::min(row_to, row_from + t * rows_per_thread);
+        const size_t to = std::min(row_to, from + rows_per_thread);
+        threads.emplace_back(convolute_rows, matrix, std::cref(kernel), height, width, m, from, to, result);
+    }
+    convolute_rows(matrix, kernel, height, width, m, row_from, std::min(row_to, row_from + rows_per_thread), result);
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef AU_PARALLEL_COMPUTING_CPU_CONVOLUTION_H
+#define AU_PARALLEL_COMPUTING_CPU_CONVOLUTION_H
+
+#include "convolution.h"
+
+/**
+ * Native counterpart of the `convolute` kernel: same zero padding and the same order
+ * of taps for every element. Rows are split between hardware threads, every row is
+ * processed in column blocks with the taps applied as vectorized row updates.
+ */
+void calculate_cpu(const float *matrix, const floats &kernel, size_t n, size_t m, float *result);
+
+/**
+ * Rows [row_from, row_to) of the convolution of a height x width matrix, into the same rows of the
+ * height x width `result`. Only the input rows within m / 2 of them are read, so a large mapped
+ * matrix can be convolved band by band.
+ */
+void calculate_cpu_rows(const float *matrix, const floats &kernel, size_t height, size_t width, size_t m,
+                        size_t row_from, size_t row_to, float *result);
+
+
+#endif //AU_PARALLEL_COMPUTING_CPU_CONVOLUTION_H
@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <thread>
+#include <vector>
+
+#include "fft_convolution.h"
+
+namespace {
+    typedef std::complex<double> complex;
+
+    // sides of the transformed tiles, powers of two; a 256 x 256 tile of doubles still fits in L2,
+    // larger ones were slower whatever the filter, and filters up to 129 fit into it
+    const size_t MIN_FFT_SIZE = 16;
+    const size_t MAX_FFT_SIZE = 256;
+
+    // time of one butterfly and of one element of the spectrum product, relative to one tap
+    // of calculate_cpu; only decides between the two, measured with the default SSE builds
+    const double BUTTERFLY_COST = 40.0;
+    const double PRODUCT_COST = 60.0;
+
+    // a * b without the inf/nan special cases of std::complex multiplication
+    inline complex multiply(const complex &a, const complex &b) {
+        return complex(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+    }
+
+    // in-place iterative radix-2 FFT of n elements
+    class fft_plan {
+    public:
+        explicit fft_plan(size_t n) : n(n), reversed(n), twiddles(n / 2) {
+            size_t bits = 0;
+            while (((size_t) 1 << bits) < n) {
+                bits++;
+            }
+            for (size_t i = 0; i < n; i++) {
+                for (size_t bit = 0; bit < bits; bit++) {
+                    reversed[i] |= ((i >> bit) & 1) << (bits - 1 - bit);
+                }
+            }
+            for (size_t k = 0; k < n / 2; k++) {
+                twiddles[k] = std::polar(1.0, -2 * M_PI * k / n);
+            }
+        }
+
+        // forward transform, or the inverse one without the 1 / n scale
+        void transform(complex *x, bool inverse) const {
+            for (size_t i = 0; i < n; i++) {
+                if (i < reversed[i]) {
+                    std::swap(x[i], x[reversed[i]]);
+                }
+            }
+            for (size_t half = 1; half < n; half *= 2) {
+                const size_t step = n / (2 * half);
+                for (size_t from = 0; from < n; from += 2 * half) {
+                    for (size_t k = 0; k < half; k++) {
+                        auto w = inverse ? std::conj(twiddles[k * step]) : twiddles[k * step];
+                        auto u = x[from + k];
+                        auto v = multiply(x[from + k + half], w);
+                        x[from + k] = u + v;
+                        x[from + k + half] = u - v;
+                    }
+                }
+            }
+        }
+
+        const size_t n;
+
+    private:
+        std::vector<size_t> reversed;
+        std::vector<complex> twiddles;
+    };
+
+    // 2D transform of an n x n array whose rows from `rows` on are zero, `column` is scratch of n elements
+    void transform_2d(const fft_plan &plan, complex *data, size_t rows, bool inverse, std::vector<complex> &column) {
+        const size_t n = plan.n;
+        for (size_t row = 0; row < rows; row++) {
+            plan.transform(data + row * n, inverse);
+        }
+        for (size_t col = 0; col < n; col++) {
+            for (size_t row = 0; row < n; row++) {
+                column[row] = data[row * n + col];
+            }
+            plan.transform(column.data(), inverse);
+            for (size_t row = 0; row < n; row++) {
+                data[row * n + col] = column[row];
+            }
+        }
+    }
+
+    size_t tile_count(size_t height, size_t width, size_t tile_sz) {
+        return ((height + tile_sz - 1) / tile_sz) * ((width + tile_sz - 1) / tile_sz);
+    }
+
+    // estimated time of calculate_fft with tiles transformed at fft_sz, in taps of calculate_cpu
+    double fft_cost(size_t height, size_t width, size_t m, size_t fft_sz) {
+        const size_t tile_sz = fft_sz - m + 1;
+        const double butterflies = fft_sz / 2 * std::log2((double) fft_sz);
+        // a pair of tiles: rows of the tile and all columns forward, all columns and rows back
+        const double pair_cost = (tile_sz + 3 * fft_sz) * butterflies * BUTTERFLY_COST +
+                                 (double) fft_sz * fft_sz * PRODUCT_COST;
+        return (tile_count(height, width, tile_sz) + 1) / 2 * pair_cost;
+    }
+
+    /**
+     * Cheapest side of the transform, 0 if the filter is too large. Tiles are at least m - 1 wide,
+     * so the halo of a tile only reaches the neighbouring tiles.
+     */
+    size_t best_fft_size(size_t height, size_t width, size_t m) {
+        size_t best = 0;
+        for (size_t fft_sz = MIN_FFT_SIZE; fft_sz <= MAX_FFT_SIZE; fft_sz *= 2) {
+            if (fft_sz + 2 < 2 * m) {
+                continue;
+            }
+            if (best == 0 || fft_cost(height, width, m, fft_sz) < fft_cost(height, width, m, best)) {
+                best = fft_sz;
+            }
+            // a single tile covers the matrix, larger ones only add padding
+            if (fft_sz - m + 1 >= std::max(height, width)) {
+                break;
+            }
+        }
+        return best;
+    }
+
+    /**
+     * Convolves the tile rows first_row, first_row + row_step, ... and adds them with their halos to
+     * `result`. Tiles are transformed two at a time: the left one as the real part, the right one as
+     * the imaginary part, both come back separated since the filter is real.
+     */
+    void convolve_tile_rows(const float *matrix, size_t height, size_t width, size_t m,
+                            const fft_plan &plan, const std::vector<complex> &spectrum,
+                            size_t first_row, size_t row_step, float *result) {
+        const size_t n = plan.n;
+        const size_t tile_sz = n - m + 1;
+        const long m2 = m / 2;
+        std::vector<complex> data(n * n);
+        std::vector<complex> column(n);
+
+        for (size_t row_from = first_row * tile_sz; row_from < height; row_from += row_step * tile_sz) {
+            const size_t rows = std::min(tile_sz, height - row_from);
+            for (size_t col_from = 0; col_from < width; col_from += 2 * tile_sz) {
+                const size_t cols = std::min(2 * tile_sz, width - col_from);
+                std::fill(data.begin(), data.end(), complex(0, 0));
+                for (size_t row = 0; row < rows; row++) {
+                    const float *in = &matrix[(row_from + row) * width + col_from];
+                    for (size_t col = 0; col < std::min(cols, tile_sz); col++) {
+                        data[row * n + col].real(in[col]);
+                    }
+                    for (size_t col = tile_sz; col < cols; col++) {
+                        data[row * n + col - tile_sz].imag(in[col]);
+                    }
+                }
+
+                transform_2d(plan, data.data(), rows, false, column);
+                for (size_t i = 0; i < n * n; i++) {
+                    data[i] = multiply(data[i], spectrum[i]);
+                }
+                transform_2d(plan, data.data(), n, true, column);
+
+                for (size_t u = 0; u < n; u++) {
+                    const long row = (long) (row_from + u) - m2;
+                    if (row < 0 || row >= (long) height) {
+                        continue;
+                    }
+                    float *out = &result[row * width];
+                    for (size_t v = 0; v < n; v++) {
+                        const long left = (long) (col_from + v) - m2;
+                        const long right = left + (long) tile_sz;
+                        if (left >= 0 && left < (long) width) {
+                            out[left] += (float) data[u * n + v].real();
+                        }
+                        if (cols > tile_sz && right < (long) width) {
+                            out[right] += (float) data[u * n + v].imag();
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void calculate_fft(const float *matrix, const floats &kernel, size_t height, size_t width, size_t m, float *result) {
+    const size_t n = best_fft_size(height, width, m);
+    assert(n != 0 && "Filter is too large for the FFT");
+    const size_t tile_sz = n - m + 1;
+    fft_plan plan(n);
+
+    // `convolute` is a correlation, that is a convolution with the flipped filter;
+    // the spectrum also carries the scale of the inverse transform
+    std::vector<complex> spectrum(n * n);
+    std::vector<complex> column(n);
+    const double scale = 1.0 / ((double) n * n);
+    for (size_t i = 0; i < m; i++) {
+        for (size_t j = 0; j < m; j++) {
+            spectrum[i * n + j] = kernel[(m - 1 - i) * m + m - 1 - j] * scale;
+        }
+    }
+    transform_2d(plan, spectrum.data(), m, false, column);
+
+    std::fill(result, result + height * width, 0.f);
+
+    // halos of tile rows of the same parity do not overlap, so they are added by different threads,
+    // even rows first, then odd ones
+    const size_t tile_rows = (height + tile_sz - 1) / tile_sz;
+    size_t threads_num = std::max(1u, std::thread::hardware_concurrency());
+    threads_num = std::min(threads_num, std::max<size_t>((tile_rows + 1) / 2, 1));
+    for (size_t parity = 0; parity < 2; parity++) {
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < threads_num; t++) {
+            threads.emplace_back(convolve_tile_rows, matrix, height, width, m, std::cref(plan), std::cref(spectrum),
+                                 parity + 2 * t, 2 * threads_num, result);
+        }
+        convolve_tile_rows(matrix, height, width, m, plan, spectrum, parity, 2 * threads_num, result);
+
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+}
+
+bool fft_preferred(size_t height, size_t width, size_t m) {
+    const size_t n = best_fft_size(height, width, m);
+    return n != 0 && fft_cost(height, width, m, n) < (double) height * width * m * m;
+}
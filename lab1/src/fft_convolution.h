@@ -0,0 +1,18 @@
+#ifndef AU_PARALLEL_COMPUTING_FFT_CONVOLUTION_H
+#define AU_PARALLEL_COMPUTING_FFT_CONVOLUTION_H
+
+#include "convolution.h"
+
+/**
+ * Convolution through the FFT for large filters: same zero padding and centring as `convolute`,
+ * O(log) work per element instead of m^2. The matrix is split into tiles that are transformed,
+ * multiplied by the spectrum of the filter and added back with their halos (overlap-add).
+ * Results match calculate_cpu up to rounding, the transforms are done in double precision.
+ */
+void calculate_fft(const float *matrix, const floats &kernel, size_t height, size_t width, size_t m, float *result);
+
+// true if calculate_fft is estimated to be faster than calculate_cpu for these sizes
+bool fft_preferred(size_t height, size_t width, size_t m);
+
+
+#endif //AU_PARALLEL_COMPUTING_FFT_CONVOLUTION_H
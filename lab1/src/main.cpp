@@ -1,70 +1,195 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
-#include <CL/opencl.h>
 #include <vector>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <memory>
+#include <stdexcept>
+#include <sys/stat.h>
+
+#include "binary_io.h"
+
+#include "convolution.h"
+#include "cpu_convolution.h"
+#include "fft_convolution.h"
+#ifdef HAVE_OPENCL
+#include "opencl_convolution.h"
+#endif
 
 using std::string;
 
 
 namespace {
-    const char *NVIDIA = "NVIDIA";
-    const char *convolute_program = "convolute_kernel.cl";
-    const char *convolute_function = "convolute";
-
-    const size_t BLOCK_SZ = 32;
-
     const char *INPUT = "input.txt";
     const char *OUTPUT = "output.txt";
     const size_t MAXN = 1024;
-    const size_t MAXM = 9;
-
-    typedef std::vector<float> floats;
+    const size_t MAXM = 101;
+    // largest filter of the OpenCL kernels, the tiled one keeps its halo in local memory
+    const size_t MAXM_OPENCL = 9;
+
+    enum class backend_type {
+        automatic, // OpenCL if there is a suitable device, CPU otherwise
+        opencl,
+        cpu
+    };
+
+    enum class algorithm_type {
+        automatic, // FFT where it is estimated to be faster or the filter is too large for OpenCL
+        direct,
+        fft        // on the CPU, see fft_convolution.h
+    };
+
+    void usage(char const *name) {
+        std::cout << "Usage: " << name;
+        std::cout << " [-b backend] ";
+        std::cout << " [-k kernel] ";
+        std::cout << " [-a algorithm] ";
+        std::cout << " [-d device] ";
+        std::cout << " [-B batch] ";
+        std::cout << " [-T rows] ";
+        std::cout << std::endl << std::endl;
+        std::cout << "OPTIONS\n";
+        std::cout << "\t-b backend\t Where to run convolution: `auto`, `opencl` or `cpu` (default `auto`)." << std::endl;
+        std::cout << "\t-k kernel\t OpenCL kernel to run: `auto`, `naive`, `tiled` or `separable` (default `auto`)." << std::endl;
+        std::cout << "\t-a algorithm\t `direct`, `fft` or `auto` (default), which takes the FFT for filters larger than "
+                  << MAXM_OPENCL << " on OpenCL and where it is estimated to be faster on the CPU."
+                  << " The FFT runs on the CPU, -T always convolves directly." << std::endl;
+        std::cout << "\t-d device\t OpenCL device: index or part of the name from `-d list`, which prints all devices best first"
+                  << " (default is $CONVOLUTION_DEVICE or the first one)." << std::endl;
+        std::cout << "\tInput is read from `" << INPUT << "`: text, or binary records (matrix, then filter)"
+                  << " which are memory-mapped. Output is written to `" << OUTPUT << "` in the same format." << std::endl;
+        std::cout << "\t-B batch\t Convolve a batch of matrices with the same filter: a directory of input files"
+                  << " or one input file followed by more matrices. Results are written to `" << OUTPUT
+                  << "` one after another, throughput is printed." << std::endl;
+        std::cout << "\t-T rows\t Out-of-core mode for rasters larger than memory: binary input with a rectangular"
+                  << " [height, width] matrix of any size, convolved `rows` rows at a time into a mapped binary `"
+                  << OUTPUT << "`. Memory is bounded by the band size, -k is ignored, throughput is printed." << std::endl;
+    }
 
-    cl_platform_id get_platform_id() {
-        static const cl_uint max_platforms = 32;
-        cl_platform_id platforms[max_platforms];
-        cl_uint num_platforms = 0;
+    algorithm_type parse_algorithm_type(const string &name) {
+        if (name == "auto") {
+            return algorithm_type::automatic;
+        } else if (name == "direct") {
+            return algorithm_type::direct;
+        } else if (name == "fft") {
+            return algorithm_type::fft;
+        }
+        throw std::invalid_argument("Unknown algorithm: " + name);
+    }
 
-        auto status = clGetPlatformIDs(max_platforms, platforms, &num_platforms);
-        assert(status == CL_SUCCESS && "Error getting platforms");
+    bool use_fft(algorithm_type algorithm, bool use_opencl, size_t height, size_t width, size_t m) {
+        if (algorithm == algorithm_type::automatic) {
+            return use_opencl ? m > MAXM_OPENCL : fft_preferred(height, width, m);
+        }
+        return algorithm == algorithm_type::fft;
+    }
 
-        char vendor[256];
-        for (cl_int i = 0; i < num_platforms; i++) {
-            status = clGetPlatformInfo(platforms[i], CL_PLATFORM_VENDOR, sizeof(vendor), &vendor, NULL);
-            assert(status == CL_SUCCESS && "Error getting platform info");
+    void check_opencl_sizes(size_t m) {
+        if (m > MAXM_OPENCL) {
+            throw binary_io::error("Filter size " + std::to_string(m) + " is too large for the OpenCL kernels,"
+                                   " the largest is " + std::to_string(MAXM_OPENCL) + ", use -a fft or -b cpu");
+        }
+    }
 
-            if (string(vendor).find(NVIDIA) != string::npos) {
-                return platforms[i];
-            }
+    backend_type parse_backend_type(const string &name) {
+        if (name == "auto") {
+            return backend_type::automatic;
+        } else if (name == "opencl") {
+            return backend_type::opencl;
+        } else if (name == "cpu") {
+            return backend_type::cpu;
         }
-        assert(0 && "No suitable platform found");
-        return nullptr;
+        throw std::invalid_argument("Unknown backend: " + name);
     }
 
-    void read_input(floats &matrix, floats &kernel, size_t &n, size_t &m) {
-        std::ifstream in(INPUT);
-        in >> n >> m;
+    // the filter is centered on its middle element, so its size must be odd
+    void check_filter_size(size_t m) {
+        if (m > MAXM || !(m & 1)) {
+            throw binary_io::error("Filter size " + std::to_string(m) + " must be odd and at most "
+                                   + std::to_string(MAXM));
+        }
+    }
 
-        assert (n >= 0 && n <= MAXN && "Invalid matrix size");
-        assert (m >= 0 && m <= MAXM && "Invalid kernel size");
-        assert ((m & 1) && "Kernel size is even");
+    void check_sizes(size_t n, size_t m) {
+        if (n > MAXN) {
+            throw binary_io::error("Matrix size " + std::to_string(n) + " is larger than " + std::to_string(MAXN));
+        }
+        check_filter_size(m);
+    }
 
+    void read_matrix(std::istream &in, floats &matrix, size_t n) {
         matrix.assign(n * n, 0);
-        kernel.assign(m * m, 0);
         for (size_t i = 0; i < n; i++) {
             for (size_t j = 0; j < n; j++) {
                 in >> matrix[i * n + j];
             }
         }
+    }
+
+    void read_input(std::istream &in, floats &matrix, floats &kernel, size_t &n, size_t &m) {
+        if (!(in >> n >> m)) {
+            throw binary_io::error("Could not read the matrix and filter sizes");
+        }
+        check_sizes(n, m);
+
+        read_matrix(in, matrix, n);
+        kernel.assign(m * m, 0);
         for (size_t i = 0; i < m * m; i++) {
             in >> kernel[i];
         }
     }
 
-    void write_output(const floats &matrix, size_t n) {
-        std::ofstream out(OUTPUT);
+    // next square float matrix of a binary file
+    const float *read_binary_matrix(binary_io::reader &in, size_t &n) {
+        binary_io::array_view array;
+        if (!in.next(array)) {
+            throw binary_io::error("Binary input is truncated");
+        }
+        if (array.type != binary_io::dtype::float32 || array.dims.size() != 2 || array.dims[0] != array.dims[1]) {
+            throw binary_io::error("Expected square float matrix");
+        }
+        n = array.dims[0];
+        return (const float *) array.data;
+    }
+
+    // binary input is a matrix record followed by a filter record
+    const float *read_binary_input(binary_io::reader &in, floats &kernel, size_t &n, size_t &m) {
+        auto matrix = read_binary_matrix(in, n);
+        auto kernel_data = read_binary_matrix(in, m);
+        check_sizes(n, m);
+        kernel.assign(kernel_data, kernel_data + m * m);
+        return matrix;
+    }
+
+    /**
+     * Matrix and filter of a single run. Text input is parsed into `text_matrix`,
+     * binary input is mapped and `matrix` points straight into the mapping.
+     */
+    struct input_data {
+        std::unique_ptr<binary_io::reader> binary;
+        floats text_matrix;
+        const float *matrix;
+        floats kernel;
+        size_t n;
+        size_t m;
+    };
+
+    void read_input(input_data &input) {
+        if (binary_io::is_binary(INPUT)) {
+            input.binary.reset(new binary_io::reader(INPUT));
+            input.matrix = read_binary_input(*input.binary, input.kernel, input.n, input.m);
+        } else {
+            std::ifstream in(INPUT);
+            read_input(in, input.text_matrix, input.kernel, input.n, input.m);
+            input.matrix = input.text_matrix.data();
+        }
+    }
 
+    void write_matrix(std::ostream &out, const float *matrix, size_t n) {
 //    out.precision(3);
 
         size_t index = 0;
@@ -73,102 +198,369 @@ namespace {
                 out << matrix[index++] << " ";
 //            out << std::fixed << matrix[index++] << " ";
             }
-            out << std::endl;
+            out << "\n";
         }
     }
 
-    void print_build_log(cl_program program, cl_device_id device) {
-        size_t log_size;
-        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &log_size);
-        string build_log(log_size, 0);
-        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, (void *) build_log.data(), NULL);
-        std::cout << build_log << std::endl;
+    // output has the format of the input
+    void write_output(const float *matrix, size_t n, bool binary) {
+        if (binary) {
+            binary_io::writer out(OUTPUT);
+            out.write(binary_io::dtype::float32, {n, n}, matrix);
+        } else {
+            std::ofstream out(OUTPUT);
+            write_matrix(out, matrix, n);
+        }
     }
 
-    template<class T>
-    void set_kernel_arg(cl_kernel kernel, cl_uint arg_num, const T &data) {
-        auto status = clSetKernelArg(kernel, arg_num, sizeof(T), &data);
-        assert(status == CL_SUCCESS && "Could not set argument");
-    }
+    /**
+     * Out-of-core convolution of a binary input whose matrix may be rectangular and larger than memory.
+     * Both the input and the output are mapped, pages of bands that are done are dropped from both.
+     */
+    void run_bands(size_t band_rows, bool use_opencl) {
+        assert(band_rows > 0 && "Band must have rows");
+        if (!binary_io::is_binary(INPUT)) {
+            throw binary_io::error(string(INPUT) + ": out-of-core mode needs binary input");
+        }
+        binary_io::reader in(INPUT);
+        binary_io::array_view array;
+        if (!in.next(array)) {
+            throw binary_io::error("Binary input is truncated");
+        }
+        if (array.type != binary_io::dtype::float32 || array.dims.size() != 2) {
+            throw binary_io::error("Expected float matrix");
+        }
+        auto height = array.dims[0];
+        auto width = array.dims[1];
+        auto matrix = (const float *) array.data;
+
+        floats kernel;
+        size_t m;
+        auto kernel_data = read_binary_matrix(in, m);
+        check_filter_size(m);
+        kernel.assign(kernel_data, kernel_data + m * m);
+        if (use_opencl) {
+            check_opencl_sizes(m);
+        }
 
-    template<class T>
-    cl_mem create_buffer(cl_context ctx, cl_mem_flags flags, size_t sz, T *ptr) {
-        cl_int status;
-        auto res = clCreateBuffer(ctx, flags, sz * sizeof(T), (void *) ptr, &status);
-        assert(status == CL_SUCCESS && "Could not create buffer");
-        return res;
-    }
+        binary_io::mapped_output out(OUTPUT, binary_io::dtype::float32, {height, width});
+        auto result = (float *) out.data();
+
+        // input rows from row_to - m / 2 on are still read by the next band
+        const size_t m2 = m / 2;
+        band_consumer band_done = [&](size_t row_from, size_t row_to) {
+            binary_io::drop_pages(result + row_from * width, (row_to - row_from) * width * sizeof(float));
+            auto drop_from = row_from < m2 ? 0 : row_from - m2;
+            auto drop_to = row_to < m2 ? 0 : row_to - m2;
+            binary_io::drop_pages(matrix + drop_from * width, (drop_to - drop_from) * width * sizeof(float));
+        };
+
+        batch_stats stats = {0, 0, 0, 0};
+#ifdef HAVE_OPENCL
+        if (use_opencl) {
+            stats = calculate_parallel_bands(matrix, kernel, height, width, m, band_rows, result, band_done);
+        }
+#endif
+        if (!use_opencl) {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t row_from = 0; row_from < height; row_from += band_rows) {
+                auto row_to = std::min<size_t>(height, row_from + band_rows);
+                calculate_cpu_rows(matrix, kernel, height, width, m, row_from, row_to, result);
+                band_done(row_from, row_to);
+                stats.frames++;
+            }
+            stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            stats.compute_seconds = stats.seconds;
+        }
 
-    void calculate_parallel(const floats &matrix, const floats &kernel, size_t n, size_t m, floats &result) {
-        auto platform_id = get_platform_id();
-        cl_device_id device_id;
-        auto status = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_GPU, 1, &device_id, NULL);
-        assert(status == CL_SUCCESS && "Error getting device_id");
-        const auto context = clCreateContext(nullptr, 1, &device_id, NULL, NULL, &status);
-        assert(status == CL_SUCCESS && "Error creating context");
+        std::cout << "bands: " << stats.frames
+                  << ", " << (stats.seconds > 0 ? height * width / stats.seconds * 1e-6 : 0) << " Mpixels/s"
+                  << ", wall " << stats.seconds << " s"
+                  << ", transfer " << stats.transfer_seconds << " s"
+                  << ", compute " << stats.compute_seconds << " s" << std::endl;
+    }
 
-        const auto command_queue = clCreateCommandQueue(context, device_id, 0, &status);
-        // No idea why it does not work this way. SIGSEGV is the least expected here.
-//    const auto command_queue = clCreateCommandQueueWithProperties(context, device_id, nullptr, &status);
-        assert(status == CL_SUCCESS && "Error creating command queue");
+    /**
+     * Frames of a batch. Either a directory where every file is a regular input
+     * (sizes and filter are taken from the first file in name order, the rest must match),
+     * or a single regular input followed by any number of n*n matrices.
+     * Text and binary files are both accepted. A missing path or an empty directory throws binary_io::error.
+     */
+    class batch_input {
+    public:
+        explicit batch_input(const string &path) {
+            struct stat path_stat;
+            if (stat(path.c_str(), &path_stat) != 0) {
+                throw binary_io::error("Could not find " + path);
+            }
 
-        auto matrix_buffer = create_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * n, matrix.data());
-        auto kernel_buffer = create_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, m * m, kernel.data());
-        auto result_buffer = create_buffer<float>(context, CL_MEM_WRITE_ONLY, n * n, nullptr);
+            if (S_ISDIR(path_stat.st_mode)) {
+                auto dir = opendir(path.c_str());
+                if (dir == nullptr) {
+                    throw binary_io::error("Could not open directory " + path);
+                }
+                while (auto entry = readdir(dir)) {
+                    string file = path + "/" + entry->d_name;
+                    struct stat file_stat;
+                    if (stat(file.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
+                        files.push_back(file);
+                    }
+                }
+                closedir(dir);
+                std::sort(files.begin(), files.end());
+            } else {
+                files.push_back(path);
+            }
+            if (files.empty()) {
+                throw binary_io::error(path + ": no input files in the batch directory");
+            }
 
-        std::ifstream program_sources_file(convolute_program);
-        string sources((std::istreambuf_iterator<char>(program_sources_file)), std::istreambuf_iterator<char>());
-        const char *sources_cstr[] = {sources.c_str()};
+            binary = binary_io::is_binary(files[0]);
+            open(files[0], first_matrix, kernel, n, m);
+            first_pending = true;
+            next_file = 1;
+        }
 
-        size_t length = sources.length();
-        auto program = clCreateProgramWithSource(context, 1, sources_cstr, &length, &status);
-        assert(status == CL_SUCCESS && "Error creating cl program source");
+        bool next(floats &matrix) {
+            if (first_pending) {
+                matrix.swap(first_matrix);
+                first_pending = false;
+                return true;
+            }
+            if (files.size() == 1) {
+                return next_matrix(matrix);
+            }
+            if (next_file == files.size()) {
+                return false;
+            }
 
-        status = clBuildProgram(program, 1, &device_id, ("-D BLOCK_SIZE=" + std::to_string(BLOCK_SZ)).c_str(), NULL, NULL);
-        if (status != CL_SUCCESS) {
-            print_build_log(program, device_id);
+            floats file_kernel;
+            size_t file_n;
+            size_t file_m;
+            auto &file = files[next_file++];
+            open(file, matrix, file_kernel, file_n, file_m);
+            // the plan of the first file is reused for all frames
+            if (file_n != n || file_m != m || file_kernel != kernel) {
+                std::cerr << file << ": all files of a batch must have the size and the filter of the first one"
+                          << std::endl;
+                exit(1);
+            }
+            return true;
         }
-        assert(status == CL_SUCCESS);
 
-        auto convolute_kernel = clCreateKernel(program, convolute_function, &status);
-        assert(status == CL_SUCCESS && "Make sure that *.cl file is in the right place");
+        bool binary;
+        floats kernel;
+        size_t n;
+        size_t m;
+
+    private:
+        // starts reading an input file, its first matrix goes to `matrix`
+        void open(const string &file, floats &matrix, floats &file_kernel, size_t &file_n, size_t &file_m) {
+            text_in.close();
+            binary_in.reset();
+            if (binary_io::is_binary(file)) {
+                binary_in.reset(new binary_io::reader(file));
+                auto data = read_binary_input(*binary_in, file_kernel, file_n, file_m);
+                matrix.assign(data, data + file_n * file_n);
+            } else {
+                text_in.open(file);
+                read_input(text_in, matrix, file_kernel, file_n, file_m);
+            }
+        }
 
-        set_kernel_arg(convolute_kernel, 0, matrix_buffer);
-        set_kernel_arg(convolute_kernel, 1, (unsigned) n);
-        set_kernel_arg(convolute_kernel, 2, kernel_buffer);
-        set_kernel_arg(convolute_kernel, 3, (unsigned) m);
-        set_kernel_arg(convolute_kernel, 4, result_buffer);
+        // one more matrix of the current file
+        bool next_matrix(floats &matrix) {
+            if (binary_in) {
+                binary_io::array_view array;
+                if (!binary_in->next(array)) {
+                    return false;
+                }
+                if (array.type != binary_io::dtype::float32 || array.count() != n * n) {
+                    throw binary_io::error("Invalid batch frame");
+                }
+                auto data = (const float *) array.data;
+                matrix.assign(data, data + n * n);
+                return true;
+            }
+            if ((text_in >> std::ws).eof()) {
+                return false;
+            }
+            read_matrix(text_in, matrix, n);
+            return true;
+        }
 
-        auto n_rounded = n + (BLOCK_SZ - n % BLOCK_SZ);
-        size_t global_ws[] = {n_rounded, n_rounded};
-        size_t local_ws[] = {BLOCK_SZ, BLOCK_SZ};
+        std::vector<string> files;
+        size_t next_file;
+        std::ifstream text_in;
+        std::unique_ptr<binary_io::reader> binary_in;
+        floats first_matrix;
+        bool first_pending;
+    };
+
+    /**
+     * Convolves every frame of `input_path`, results go to OUTPUT one after another:
+     * as binary records if the input is binary, as text matrices separated by empty lines otherwise.
+     */
+    void run_batch(const string &input_path, bool use_opencl, kernel_type type, algorithm_type algorithm) {
+        batch_input input(input_path);
+        bool fft = use_fft(algorithm, use_opencl, input.n, input.n, input.m);
+        use_opencl = use_opencl && !fft;
+        if (use_opencl) {
+            check_opencl_sizes(input.m);
+        }
+        std::unique_ptr<binary_io::writer> binary_out;
+        std::ofstream text_out;
+        if (input.binary) {
+            binary_out.reset(new binary_io::writer(OUTPUT));
+        } else {
+            text_out.open(OUTPUT);
+        }
 
-        status = clEnqueueNDRangeKernel(command_queue, convolute_kernel, 2, nullptr, global_ws, local_ws, 0, NULL, NULL);
-        assert(status == CL_SUCCESS);
+        frame_reader read_frame = [&](floats &matrix) {
+            return input.next(matrix);
+        };
+        frame_writer write_frame = [&](const floats &result) {
+            if (binary_out) {
+                binary_out->write(binary_io::dtype::float32, {input.n, input.n}, result.data());
+            } else {
+                write_matrix(text_out, result.data(), input.n);
+                text_out << "\n";
+            }
+        };
 
-        clEnqueueReadBuffer(command_queue, result_buffer, CL_TRUE, 0, n * n * sizeof(float), result.data(), 0, NULL, NULL);
+        batch_stats stats = {0, 0, 0, 0};
+#ifdef HAVE_OPENCL
+        if (use_opencl) {
+            stats = calculate_parallel_batch(input.kernel, input.n, input.m, type, read_frame, write_frame);
+        }
+#else
+        (void) type;
+#endif
+        if (!use_opencl) {
+            auto start = std::chrono::steady_clock::now();
+            floats matrix;
+            floats result(input.n * input.n);
+            while (read_frame(matrix)) {
+                auto compute_start = std::chrono::steady_clock::now();
+                if (fft) {
+                    calculate_fft(matrix.data(), input.kernel, input.n, input.n, input.m, result.data());
+                } else {
+                    calculate_cpu(matrix.data(), input.kernel, input.n, input.m, result.data());
+                }
+                stats.compute_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - compute_start).count();
+                write_frame(result);
+                stats.frames++;
+            }
+            stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
 
-        clReleaseKernel(convolute_kernel);
-        clReleaseCommandQueue(command_queue);
-        clReleaseContext(context);
-        clReleaseMemObject(matrix_buffer);
-        clReleaseMemObject(kernel_buffer);
-        clReleaseMemObject(result_buffer);
+        std::cout << "frames: " << stats.frames
+                  << ", " << (stats.seconds > 0 ? stats.frames / stats.seconds : 0) << " frames/s"
+                  << ", wall " << stats.seconds << " s"
+                  << ", transfer " << stats.transfer_seconds << " s"
+                  << ", compute " << stats.compute_seconds << " s" << std::endl;
     }
 }
 
-int main(void) {
-    floats matrix;
-    floats kernel;
-    size_t n;
-    size_t m;
+int main(int argc, char **argv) {
+    backend_type backend = backend_type::automatic;
+    kernel_type type = kernel_type::automatic;
+    algorithm_type algorithm = algorithm_type::automatic;
+    string batch_path;
+    size_t band_rows = 0;
+
+    // parse_* throw std::invalid_argument for unknown values, std::stoul throws for malformed numbers
+    try {
+        for (int i = 1; i < argc; i += 2) {
+            string flag = argv[i];
+            if (flag == "-h" || flag == "--help") {
+                usage(argv[0]);
+                exit(0);
+            } else if (flag == "-b" && i + 1 < argc) {
+                backend = parse_backend_type(argv[i + 1]);
+            } else if (flag == "-k" && i + 1 < argc) {
+                type = parse_kernel_type(argv[i + 1]);
+            } else if (flag == "-a" && i + 1 < argc) {
+                algorithm = parse_algorithm_type(argv[i + 1]);
+            } else if (flag == "-B" && i + 1 < argc) {
+                batch_path = argv[i + 1];
+            } else if (flag == "-T" && i + 1 < argc) {
+                band_rows = std::stoul(argv[i + 1]);
+#ifdef HAVE_OPENCL
+            } else if (flag == "-d" && i + 1 < argc && string(argv[i + 1]) == "list") {
+                auto devices = opencl_devices();
+                for (size_t j = 0; j < devices.size(); j++) {
+                    std::cout << j << ": " << devices[j] << std::endl;
+                }
+                exit(0);
+            } else if (flag == "-d" && i + 1 < argc) {
+                set_opencl_device(argv[i + 1]);
+#endif
+            } else {
+                usage(argv[0]);
+                exit(1);
+            }
+        }
+    } catch (const std::logic_error &e) {
+        std::cerr << e.what() << std::endl;
+        usage(argv[0]);
+        exit(1);
+    }
 
-    read_input(matrix, kernel, n, m);
+#ifdef HAVE_OPENCL
+    if (backend == backend_type::opencl && !opencl_available()) {
+        std::cerr << "No suitable OpenCL device found" << std::endl;
+        exit(1);
+    }
+    bool use_opencl = backend == backend_type::opencl || (backend == backend_type::automatic && opencl_available());
+#else
+    if (backend == backend_type::opencl) {
+        std::cerr << "Built without OpenCL support" << std::endl;
+        exit(1);
+    }
+    bool use_opencl = false;
+#endif
+
+    // broken or invalid input, failed file operations and failed OpenCL calls throw in every build
+    try {
+        if (!batch_path.empty()) {
+            run_batch(batch_path, use_opencl, type, algorithm);
+            return 0;
+        }
 
-    floats result(n * n);
-    calculate_parallel(matrix, kernel, n, m, result);
+        if (band_rows > 0) {
+            run_bands(band_rows, use_opencl);
+            return 0;
+        }
 
-    write_output(result, n);
+        input_data input;
+        read_input(input);
+        auto n = input.n;
+        bool binary = input.binary != nullptr;
+        bool fft = use_fft(algorithm, use_opencl, n, n, input.m);
+        use_opencl = use_opencl && !fft;
+
+#ifdef HAVE_OPENCL
+        if (use_opencl) {
+            check_opencl_sizes(input.m);
+            calculate_parallel(input.matrix, input.kernel, n, input.m, type, [&](const float *result) {
+                write_output(result, n, binary);
+            });
+        }
+#endif
+        if (!use_opencl) {
+            floats result(n * n);
+            if (fft) {
+                calculate_fft(input.matrix, input.kernel, n, n, input.m, result.data());
+            } else {
+                calculate_cpu(input.matrix, input.kernel, n, input.m, result.data());
+            }
+            write_output(result.data(), n, binary);
+        }
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
 
     return 0;
-}
\ No newline at end of file
+}
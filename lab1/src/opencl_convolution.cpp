@@ -0,0 +1,793 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cctype>
+#include <climits>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <chrono>
+#include <CL/opencl.h>
+
+#include "convolute_kernel.cl.h"
+#include "opencl_convolution.h"
+#include "program_cache.h"
+
+using std::string;
+
+
+namespace {
+    const char *convolute_function = "convolute";
+    const char *convolute_tiled_function = "convolute_tiled";
+    const char *convolute_rows_function = "convolute_rows";
+    const char *convolute_cols_function = "convolute_cols";
+    const char *convolute_band_function = "convolute_band";
+    const char *convolute_functions[] = {convolute_function, convolute_tiled_function, convolute_rows_function,
+                                         convolute_cols_function, convolute_band_function};
+
+    const size_t BLOCK_SZ = 32;
+
+    // frames in flight in batch mode: one being uploaded, one convolved, one read back
+    const size_t BATCH_SLOTS = 3;
+
+    // relative tolerance of the rank-1 check in split_separable
+    const float SEPARABLE_EPS = 1e-6f;
+
+    struct device_desc {
+        cl_device_id id;
+        string name;
+        cl_device_type type;
+        cl_uint compute_units;
+        size_t max_work_group_sz;
+    };
+
+    // environment variable with the same meaning as set_opencl_device
+    const char *DEVICE_ENV = "CONVOLUTION_DEVICE";
+    string g_device_selector;
+
+    // failed OpenCL calls throw in every build, main prints the error and exits
+    void check_status(cl_int status, const char *what) {
+        if (status != CL_SUCCESS) {
+            throw std::runtime_error(string(what) + ", OpenCL error " + std::to_string(status));
+        }
+    }
+
+    template<class T>
+    T get_device_info(cl_device_id device, cl_device_info param) {
+        T value;
+        auto status = clGetDeviceInfo(device, param, sizeof(T), &value, NULL);
+        check_status(status, "Error getting device info");
+        return value;
+    }
+
+    // largest work-group size of every dimension
+    std::vector<size_t> get_work_item_sizes(cl_device_id device) {
+        auto dims = get_device_info<cl_uint>(device, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS);
+        std::vector<size_t> sizes(dims);
+        auto status = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, dims * sizeof(size_t), sizes.data(), NULL);
+        check_status(status, "Error getting device info");
+        return sizes;
+    }
+
+    string get_device_string(cl_device_id device, cl_device_info param) {
+        char value[256] = {0};
+        auto status = clGetDeviceInfo(device, param, sizeof(value) - 1, value, NULL);
+        check_status(status, "Error getting device info");
+        return value;
+    }
+
+    int type_rank(cl_device_type type) {
+        if (type & CL_DEVICE_TYPE_GPU) {
+            return 3;
+        } else if (type & CL_DEVICE_TYPE_ACCELERATOR) {
+            return 2;
+        } else if (type & CL_DEVICE_TYPE_CPU) {
+            return 1;
+        }
+        return 0;
+    }
+
+    // all devices of all platforms, best first: GPUs before accelerators before CPUs,
+    // then more compute units, then larger work-groups
+    std::vector<device_desc> discover_devices() {
+        static const cl_uint max_platforms = 32;
+        static const cl_uint max_devices = 64;
+        cl_platform_id platforms[max_platforms];
+        cl_uint num_platforms = 0;
+
+        std::vector<device_desc> devices;
+        if (clGetPlatformIDs(max_platforms, platforms, &num_platforms) != CL_SUCCESS) {
+            return devices;
+        }
+
+        char platform_name[256];
+        for (cl_uint i = 0; i < num_platforms && i < max_platforms; i++) {
+            auto status = clGetPlatformInfo(platforms[i], CL_PLATFORM_NAME, sizeof(platform_name), &platform_name, NULL);
+            check_status(status, "Error getting platform info");
+
+            cl_device_id ids[max_devices];
+            cl_uint num_devices = 0;
+            if (clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, max_devices, ids, &num_devices) != CL_SUCCESS) {
+                continue;
+            }
+            for (cl_uint j = 0; j < num_devices && j < max_devices; j++) {
+                device_desc desc;
+                desc.id = ids[j];
+                desc.name = string(platform_name) + " / " + get_device_string(ids[j], CL_DEVICE_NAME);
+                desc.type = get_device_info<cl_device_type>(ids[j], CL_DEVICE_TYPE);
+                desc.compute_units = get_device_info<cl_uint>(ids[j], CL_DEVICE_MAX_COMPUTE_UNITS);
+                desc.max_work_group_sz = get_device_info<size_t>(ids[j], CL_DEVICE_MAX_WORK_GROUP_SIZE);
+                devices.push_back(desc);
+            }
+        }
+
+        std::stable_sort(devices.begin(), devices.end(), [](const device_desc &a, const device_desc &b) {
+            if (type_rank(a.type) != type_rank(b.type)) {
+                return type_rank(a.type) > type_rank(b.type);
+            }
+            if (a.compute_units != b.compute_units) {
+                return a.compute_units > b.compute_units;
+            }
+            return a.max_work_group_sz > b.max_work_group_sz;
+        });
+        return devices;
+    }
+
+    string to_lower(string s) {
+        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return (char) std::tolower(c); });
+        return s;
+    }
+
+    /**
+     * Picks a device out of the ranked list. Selector is either an index in the list
+     * or a case insensitive part of "platform / device" name, empty selector means the best device.
+     */
+    bool find_device(device_desc &device) {
+        auto devices = discover_devices();
+        string selector = g_device_selector;
+        if (selector.empty() && std::getenv(DEVICE_ENV) != nullptr) {
+            selector = std::getenv(DEVICE_ENV);
+        }
+
+        if (selector.empty()) {
+            if (devices.empty()) {
+                return false;
+            }
+            device = devices.front();
+            return true;
+        }
+
+        if (std::all_of(selector.begin(), selector.end(), ::isdigit)) {
+            size_t index = std::stoul(selector);
+            if (index < devices.size()) {
+                device = devices[index];
+                return true;
+            }
+        } else {
+            for (const auto &desc : devices) {
+                if (to_lower(desc.name).find(to_lower(selector)) != string::npos) {
+                    device = desc;
+                    return true;
+                }
+            }
+        }
+        std::cerr << "OpenCL device `" << selector << "` not found" << std::endl;
+        return false;
+    }
+
+    /**
+     * Checks whether m*m filter is an outer product col * row^T and finds the factors.
+     * Pivot is the largest element: its column and its row (scaled) are the candidates,
+     * every other element has to match their product up to SEPARABLE_EPS * max|kernel|.
+     */
+    bool split_separable(const floats &kernel, size_t m, floats &col, floats &row) {
+        size_t pivot = 0;
+        for (size_t i = 1; i < m * m; i++) {
+            if (std::fabs(kernel[i]) > std::fabs(kernel[pivot])) {
+                pivot = i;
+            }
+        }
+
+        col.assign(m, 0);
+        row.assign(m, 0);
+        const float max_abs = std::fabs(kernel[pivot]);
+        if (max_abs == 0) {
+            return true;
+        }
+
+        const size_t pivot_row = pivot / m;
+        const size_t pivot_col = pivot % m;
+        for (size_t i = 0; i < m; i++) {
+            col[i] = kernel[i * m + pivot_col];
+            row[i] = kernel[pivot_row * m + i] / kernel[pivot];
+        }
+
+        for (size_t i = 0; i < m; i++) {
+            for (size_t j = 0; j < m; j++) {
+                if (std::fabs(col[i] * row[j] - kernel[i * m + j]) > SEPARABLE_EPS * max_abs) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void print_build_log(cl_program program, cl_device_id device) {
+        size_t log_size;
+        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &log_size);
+        string build_log(log_size, 0);
+        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, (void *) build_log.data(), NULL);
+        std::cout << build_log << std::endl;
+    }
+
+    template<class T>
+    void set_kernel_arg(cl_kernel kernel, cl_uint arg_num, const T &data) {
+        auto status = clSetKernelArg(kernel, arg_num, sizeof(T), &data);
+        check_status(status, "Could not set argument");
+    }
+
+    void set_local_arg(cl_kernel kernel, cl_uint arg_num, size_t sz) {
+        auto status = clSetKernelArg(kernel, arg_num, sz, nullptr);
+        check_status(status, "Could not set local memory argument");
+    }
+
+    template<class T>
+    cl_mem create_buffer(cl_context ctx, cl_mem_flags flags, size_t sz, T *ptr) {
+        cl_int status;
+        auto res = clCreateBuffer(ctx, flags, sz * sizeof(T), (void *) ptr, &status);
+        check_status(status, "Could not create buffer");
+        return res;
+    }
+
+    cl_kernel create_kernel(cl_program program, const char *function) {
+        cl_int status;
+        auto kernel = clCreateKernel(program, function, &status);
+        check_status(status, "Kernel is not in the program");
+        return kernel;
+    }
+
+    // one work-item per element of a rows x cols output, block_sz x block_sz work-groups
+    cl_event enqueue_kernel(cl_command_queue command_queue, cl_kernel kernel, size_t rows, size_t cols,
+                            size_t block_sz, cl_uint num_wait_events, const cl_event *wait_events) {
+        size_t global_ws[] = {rows + (block_sz - rows % block_sz), cols + (block_sz - cols % block_sz)};
+        size_t local_ws[] = {block_sz, block_sz};
+
+        cl_event event;
+        auto status = clEnqueueNDRangeKernel(command_queue, kernel, 2, nullptr, global_ws, local_ws,
+                                             num_wait_events, wait_events, &event);
+        check_status(status, "Could not enqueue kernel");
+        return event;
+    }
+
+    double event_seconds(cl_event event) {
+        cl_ulong start = 0;
+        cl_ulong end = 0;
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+        return (end - start) * 1e-9;
+    }
+
+    void release_events(std::vector<cl_event> &events) {
+        for (auto event : events) {
+            clReleaseEvent(event);
+        }
+        events.clear();
+    }
+
+    /**
+     * Device, context, queue and built programs shared by all convolutions of the process.
+     * Created on first use, released at exit. There is a program for every filter side,
+     * built with `-D M=m` the first time a filter of that side is convolved.
+     */
+    class cl_environment {
+    public:
+        static cl_environment &get() {
+            static cl_environment environment;
+            return environment;
+        }
+
+        // kernel of the program for m x m filters
+        cl_kernel kernel(size_t m, const char *function) {
+            auto key = std::make_pair(m, string(function));
+            auto it = kernels.find(key);
+            if (it == kernels.end()) {
+                it = kernels.insert({key, create_kernel(program(m), function)}).first;
+            }
+            return it->second;
+        }
+
+        // one more queue on the same device, e.g. to overlap transfers with kernels
+        cl_command_queue create_queue(cl_command_queue_properties properties) {
+            cl_int status;
+            auto queue = clCreateCommandQueue(context, device_id, properties, &status);
+            check_status(status, "Error creating command queue");
+            return queue;
+        }
+
+        cl_device_id device_id;
+        cl_context context;
+        cl_command_queue command_queue;
+        // side of a square work-group, the largest power of two up to BLOCK_SZ the device can run
+        size_t block_sz;
+
+        // side of the work-groups of the program for m x m filters, block_sz or less if its kernels need it
+        size_t block_size(size_t m) {
+            program(m);
+            return block_sizes[m];
+        }
+
+    private:
+        cl_environment() {
+            device_desc device;
+            if (!find_device(device)) {
+                throw std::runtime_error("No suitable OpenCL device found");
+            }
+            device_id = device.id;
+
+            // work-groups are block_sz x block_sz, both dimensions and their product have limits
+            auto item_sizes = get_work_item_sizes(device_id);
+            block_sz = BLOCK_SZ;
+            while (block_sz > 1 && (block_sz * block_sz > device.max_work_group_sz ||
+                                    block_sz > item_sizes[0] || block_sz > item_sizes[1])) {
+                block_sz /= 2;
+            }
+
+            cl_int status;
+            context = clCreateContext(nullptr, 1, &device_id, NULL, NULL, &status);
+            check_status(status, "Error creating context");
+
+            command_queue = clCreateCommandQueue(context, device_id, 0, &status);
+            // No idea why it does not work this way. SIGSEGV is the least expected here.
+//        command_queue = clCreateCommandQueueWithProperties(context, device_id, nullptr, &status);
+            check_status(status, "Error creating command queue");
+        }
+
+        ~cl_environment() {
+            for (auto &kernel : kernels) {
+                clReleaseKernel(kernel.second);
+            }
+            for (auto &program : programs) {
+                clReleaseProgram(program.second);
+            }
+            clReleaseCommandQueue(command_queue);
+            clReleaseContext(context);
+        }
+
+        cl_environment(const cl_environment &) = delete;
+        cl_environment &operator=(const cl_environment &) = delete;
+
+        cl_program program(size_t m) {
+            auto it = programs.find(m);
+            if (it != programs.end()) {
+                return it->second;
+            }
+
+            // a kernel may use too many registers for a block_sz x block_sz work-group,
+            // then the program is built again for smaller ones
+            size_t block = block_sz;
+            for (;;) {
+                auto program = build_program(m, block);
+                if (block == 1 || kernels_fit(program, block * block)) {
+                    programs[m] = program;
+                    block_sizes[m] = block;
+                    return program;
+                }
+                clReleaseProgram(program);
+                block /= 2;
+            }
+        }
+
+        cl_program build_program(size_t m, size_t block) {
+            // binaries of earlier runs are reused, see program_cache.h
+            cl_int status;
+            auto options = "-D BLOCK_SIZE=" + std::to_string(block) + " -D M=" + std::to_string(m);
+            auto program = program_cache::build_program(context, device_id, convolute_kernel_source, options, status);
+            if (status != CL_SUCCESS && program != nullptr) {
+                print_build_log(program, device_id);
+            }
+            check_status(status, "Could not build the convolution program");
+            return program;
+        }
+
+        // true if every kernel of the program runs in work-groups of work_group_sz
+        bool kernels_fit(cl_program program, size_t work_group_sz) {
+            for (auto function : convolute_functions) {
+                auto kernel = create_kernel(program, function);
+                size_t kernel_sz;
+                auto status = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE,
+                                                       sizeof(kernel_sz), &kernel_sz, NULL);
+                check_status(status, "Error getting kernel work-group info");
+                clReleaseKernel(kernel);
+                if (kernel_sz < work_group_sz) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // by filter side
+        std::map<size_t, cl_program> programs;
+        std::map<size_t, size_t> block_sizes;
+        std::map<std::pair<size_t, string>, cl_kernel> kernels;
+    };
+
+    /**
+     * Kernels and filter buffers picked for one filter, enqueued for any number of n*n matrices.
+     */
+    class convolution_plan {
+    public:
+        convolution_plan(const floats &kernel, size_t n, size_t m, kernel_type type)
+                : environment(cl_environment::get()), n(n), m(m), type(type) {
+            floats col_filter;
+            floats row_filter;
+            bool separable = split_separable(kernel, m, col_filter, row_filter);
+            if (type == kernel_type::automatic) {
+                this->type = separable ? kernel_type::separable : kernel_type::tiled;
+            } else if (type == kernel_type::separable && !separable) {
+                // the factors would only hold a part of the filter
+                std::cerr << "Filter is not separable, using the tiled kernel" << std::endl;
+                this->type = kernel_type::tiled;
+            }
+
+            auto context = environment.context;
+            if (this->type == kernel_type::separable) {
+                filter_buffers.push_back(create_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, m, row_filter.data()));
+                filter_buffers.push_back(create_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, m, col_filter.data()));
+            } else {
+                filter_buffers.push_back(create_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, m * m, kernel.data()));
+            }
+        }
+
+        ~convolution_plan() {
+            for (auto buffer : filter_buffers) {
+                clReleaseMemObject(buffer);
+            }
+        }
+
+        convolution_plan(const convolution_plan &) = delete;
+        convolution_plan &operator=(const convolution_plan &) = delete;
+
+        // scratch n*n buffer enqueue needs, nullptr if none
+        cl_mem create_temp_buffer() const {
+            if (type != kernel_type::separable) {
+                return nullptr;
+            }
+            return create_buffer<float>(environment.context, CL_MEM_READ_WRITE, n * n, nullptr);
+        }
+
+        /**
+         * Enqueues convolution of `input` into `output` after `wait_event` (may be nullptr).
+         * Returns events of the enqueued kernels in order, caller releases them.
+         */
+        std::vector<cl_event> enqueue(cl_command_queue queue, cl_mem input, cl_mem output, cl_mem temp,
+                                      cl_event wait_event) {
+            cl_uint num_wait_events = wait_event == nullptr ? 0 : 1;
+            const cl_event *wait_events = wait_event == nullptr ? nullptr : &wait_event;
+            auto block_sz = environment.block_size(m);
+
+            if (type == kernel_type::separable) {
+                auto rows_kernel = environment.kernel(m, convolute_rows_function);
+                set_kernel_arg(rows_kernel, 0, input);
+                set_kernel_arg(rows_kernel, 1, (unsigned) n);
+                set_kernel_arg(rows_kernel, 2, filter_buffers[0]);
+                set_kernel_arg(rows_kernel, 3, temp);
+
+                auto cols_kernel = environment.kernel(m, convolute_cols_function);
+                set_kernel_arg(cols_kernel, 0, temp);
+                set_kernel_arg(cols_kernel, 1, (unsigned) n);
+                set_kernel_arg(cols_kernel, 2, filter_buffers[1]);
+                set_kernel_arg(cols_kernel, 3, output);
+
+                auto rows_event = enqueue_kernel(queue, rows_kernel, n, n, block_sz, num_wait_events, wait_events);
+                auto cols_event = enqueue_kernel(queue, cols_kernel, n, n, block_sz, 1, &rows_event);
+                return {rows_event, cols_event};
+            }
+
+            auto function = type == kernel_type::tiled ? convolute_tiled_function : convolute_function;
+            auto convolute_kernel = environment.kernel(m, function);
+            set_kernel_arg(convolute_kernel, 0, input);
+            set_kernel_arg(convolute_kernel, 1, (unsigned) n);
+            set_kernel_arg(convolute_kernel, 2, filter_buffers[0]);
+            set_kernel_arg(convolute_kernel, 3, output);
+            if (type == kernel_type::tiled) {
+                auto tile_sz = block_sz + m - 1;
+                set_local_arg(convolute_kernel, 4, tile_sz * tile_sz * sizeof(float));
+            }
+            return {enqueue_kernel(queue, convolute_kernel, n, n, block_sz, num_wait_events, wait_events)};
+        }
+
+    private:
+        cl_environment &environment;
+        size_t n;
+        size_t m;
+        kernel_type type;
+        std::vector<cl_mem> filter_buffers;
+    };
+
+    /**
+     * One frame of the batch pipeline: host copies of the matrix and of the result,
+     * device buffers for them and events of the commands in flight.
+     */
+    struct batch_slot {
+        floats input;
+        floats output;
+        cl_mem input_buffer;
+        cl_mem output_buffer;
+        cl_mem temp_buffer;
+        cl_event write_event;
+        std::vector<cl_event> kernel_events;
+        cl_event read_event;
+        bool busy;
+    };
+
+    // waits for the frame of the slot to be read back and hands it to the writer
+    void retire_slot(batch_slot &slot, const frame_writer &write_frame, batch_stats &stats) {
+        clWaitForEvents(1, &slot.read_event);
+
+        stats.transfer_seconds += event_seconds(slot.write_event) + event_seconds(slot.read_event);
+        for (auto event : slot.kernel_events) {
+            stats.compute_seconds += event_seconds(event);
+        }
+        stats.frames++;
+
+        clReleaseEvent(slot.write_event);
+        clReleaseEvent(slot.read_event);
+        release_events(slot.kernel_events);
+        slot.busy = false;
+
+        write_frame(slot.output);
+    }
+
+    /**
+     * One band of the out-of-core pipeline: its input rows with the halo and its output rows
+     * on the device, the results are read back straight into the caller's matrix.
+     */
+    struct band_slot {
+        cl_mem input_buffer;
+        cl_mem output_buffer;
+        size_t row_from;
+        size_t row_to;
+        cl_event write_event;
+        cl_event kernel_event;
+        cl_event read_event;
+        bool busy;
+    };
+
+    // waits for the rows of the slot to be read back and hands them to the consumer
+    void retire_band(band_slot &slot, const band_consumer &band_done, batch_stats &stats) {
+        clWaitForEvents(1, &slot.read_event);
+
+        stats.transfer_seconds += event_seconds(slot.write_event) + event_seconds(slot.read_event);
+        stats.compute_seconds += event_seconds(slot.kernel_event);
+        stats.frames++;
+
+        clReleaseEvent(slot.write_event);
+        clReleaseEvent(slot.kernel_event);
+        clReleaseEvent(slot.read_event);
+        slot.busy = false;
+
+        band_done(slot.row_from, slot.row_to);
+    }
+}
+
+void set_opencl_device(const string &selector) {
+    g_device_selector = selector;
+}
+
+std::vector<string> opencl_devices() {
+    std::vector<string> names;
+    for (const auto &device : discover_devices()) {
+        names.push_back(device.name + " (" + std::to_string(device.compute_units) + " compute units, work-group " +
+                        std::to_string(device.max_work_group_sz) + ")");
+    }
+    return names;
+}
+
+bool opencl_available() {
+    device_desc device;
+    return find_device(device);
+}
+
+void calculate_parallel(const float *matrix, const floats &kernel, size_t n, size_t m, kernel_type type,
+                        const result_consumer &consume) {
+    auto &environment = cl_environment::get();
+    auto context = environment.context;
+    auto command_queue = environment.command_queue;
+    convolution_plan plan(kernel, n, m, type);
+
+    auto matrix_buffer = create_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * n, matrix);
+    auto result_buffer = create_buffer<float>(context, CL_MEM_READ_WRITE, n * n, nullptr);
+    auto temp_buffer = plan.create_temp_buffer();
+
+    auto events = plan.enqueue(command_queue, matrix_buffer, result_buffer, temp_buffer, nullptr);
+    cl_int status;
+    auto result = clEnqueueMapBuffer(command_queue, result_buffer, CL_TRUE, CL_MAP_READ, 0, n * n * sizeof(float),
+                                     1, &events.back(), NULL, &status);
+    check_status(status, "Could not map result");
+    consume((const float *) result);
+    clEnqueueUnmapMemObject(command_queue, result_buffer, result, 0, NULL, NULL);
+    clFinish(command_queue);
+    release_events(events);
+
+    clReleaseMemObject(matrix_buffer);
+    clReleaseMemObject(result_buffer);
+    if (temp_buffer != nullptr) {
+        clReleaseMemObject(temp_buffer);
+    }
+}
+
+batch_stats calculate_parallel_batch(const floats &kernel, size_t n, size_t m, kernel_type type,
+                                     const frame_reader &read_frame, const frame_writer &write_frame) {
+    auto &environment = cl_environment::get();
+    auto context = environment.context;
+    convolution_plan plan(kernel, n, m, type);
+
+    // separate in-order queues, so that upload, kernels and readback of different frames overlap
+    auto upload_queue = environment.create_queue(CL_QUEUE_PROFILING_ENABLE);
+    auto compute_queue = environment.create_queue(CL_QUEUE_PROFILING_ENABLE);
+    auto download_queue = environment.create_queue(CL_QUEUE_PROFILING_ENABLE);
+
+    std::vector<batch_slot> slots(BATCH_SLOTS);
+    for (auto &slot : slots) {
+        slot.input.resize(n * n);
+        slot.output.resize(n * n);
+        slot.input_buffer = create_buffer<float>(context, CL_MEM_READ_ONLY, n * n, nullptr);
+        slot.output_buffer = create_buffer<float>(context, CL_MEM_WRITE_ONLY, n * n, nullptr);
+        slot.temp_buffer = plan.create_temp_buffer();
+        slot.busy = false;
+    }
+
+    batch_stats stats = {0, 0, 0, 0};
+    auto start = std::chrono::steady_clock::now();
+
+    // frame k goes to slot k % BATCH_SLOTS: while it is read from disk and uploaded,
+    // the previous frames are still being convolved and read back
+    size_t frame = 0;
+    for (;; frame++) {
+        auto &slot = slots[frame % BATCH_SLOTS];
+        if (slot.busy) {
+            retire_slot(slot, write_frame, stats);
+        }
+        if (!read_frame(slot.input)) {
+            break;
+        }
+
+        auto bytes = n * n * sizeof(float);
+        auto status = clEnqueueWriteBuffer(upload_queue, slot.input_buffer, CL_FALSE, 0, bytes, slot.input.data(),
+                                           0, NULL, &slot.write_event);
+        check_status(status, "Could not enqueue write");
+
+        slot.kernel_events = plan.enqueue(compute_queue, slot.input_buffer, slot.output_buffer, slot.temp_buffer,
+                                          slot.write_event);
+
+        status = clEnqueueReadBuffer(download_queue, slot.output_buffer, CL_FALSE, 0, bytes, slot.output.data(),
+                                     1, &slot.kernel_events.back(), &slot.read_event);
+        check_status(status, "Could not enqueue read");
+        slot.busy = true;
+
+        clFlush(upload_queue);
+        clFlush(compute_queue);
+        clFlush(download_queue);
+    }
+
+    // frames still in flight, oldest first
+    for (size_t i = 1; i < BATCH_SLOTS; i++) {
+        auto &slot = slots[(frame + i) % BATCH_SLOTS];
+        if (slot.busy) {
+            retire_slot(slot, write_frame, stats);
+        }
+    }
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (auto &slot : slots) {
+        clReleaseMemObject(slot.input_buffer);
+        clReleaseMemObject(slot.output_buffer);
+        if (slot.temp_buffer != nullptr) {
+            clReleaseMemObject(slot.temp_buffer);
+        }
+    }
+    clReleaseCommandQueue(upload_queue);
+    clReleaseCommandQueue(compute_queue);
+    clReleaseCommandQueue(download_queue);
+
+    return stats;
+}
+
+batch_stats calculate_parallel_bands(const float *matrix, const floats &kernel, size_t height, size_t width, size_t m,
+                                     size_t band_rows, float *result, const band_consumer &band_done) {
+    auto &environment = cl_environment::get();
+    auto context = environment.context;
+    auto block_sz = environment.block_size(m);
+    const size_t m2 = m / 2;
+    const size_t halo_rows = band_rows + m - 1;
+    // the band kernel indexes a band with int
+    if (halo_rows * width > INT_MAX) {
+        throw std::runtime_error("Band of " + std::to_string(band_rows) + " rows is too large, use fewer rows");
+    }
+
+    auto band_kernel = environment.kernel(m, convolute_band_function);
+    auto filter_buffer = create_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, m * m, kernel.data());
+    set_kernel_arg(band_kernel, 1, (unsigned) width);
+    set_kernel_arg(band_kernel, 5, filter_buffer);
+
+    auto upload_queue = environment.create_queue(CL_QUEUE_PROFILING_ENABLE);
+    auto compute_queue = environment.create_queue(CL_QUEUE_PROFILING_ENABLE);
+    auto download_queue = environment.create_queue(CL_QUEUE_PROFILING_ENABLE);
+
+    // device memory does not depend on the height: BATCH_SLOTS bands of input with halos and of output
+    std::vector<band_slot> slots(BATCH_SLOTS);
+    for (auto &slot : slots) {
+        slot.input_buffer = create_buffer<float>(context, CL_MEM_READ_ONLY, halo_rows * width, nullptr);
+        slot.output_buffer = create_buffer<float>(context, CL_MEM_WRITE_ONLY, band_rows * width, nullptr);
+        slot.busy = false;
+    }
+
+    batch_stats stats = {0, 0, 0, 0};
+    auto start = std::chrono::steady_clock::now();
+
+    // band k goes to slot k % BATCH_SLOTS, like frames of calculate_parallel_batch
+    size_t band = 0;
+    for (size_t row_from = 0; row_from < height; row_from += band_rows, band++) {
+        auto &slot = slots[band % BATCH_SLOTS];
+        if (slot.busy) {
+            retire_band(slot, band_done, stats);
+        }
+        slot.row_from = row_from;
+        slot.row_to = std::min(height, row_from + band_rows);
+        auto rows = slot.row_to - row_from;
+
+        // rows of the matrix the band reads, buffer row 0 is row_from - m2
+        auto halo_from = row_from < m2 ? 0 : row_from - m2;
+        auto halo_to = std::min(height, slot.row_to + m2);
+        auto valid_from = halo_from + m2 - row_from;
+        auto valid_to = halo_to + m2 - row_from;
+
+        auto status = clEnqueueWriteBuffer(upload_queue, slot.input_buffer, CL_FALSE,
+                                           valid_from * width * sizeof(float),
+                                           (halo_to - halo_from) * width * sizeof(float),
+                                           matrix + halo_from * width, 0, NULL, &slot.write_event);
+        check_status(status, "Could not enqueue write");
+
+        // arguments are captured when the kernel is enqueued, so the next band may set them again
+        set_kernel_arg(band_kernel, 0, slot.input_buffer);
+        set_kernel_arg(band_kernel, 2, (unsigned) valid_from);
+        set_kernel_arg(band_kernel, 3, (unsigned) valid_to);
+        set_kernel_arg(band_kernel, 4, (unsigned) rows);
+        set_kernel_arg(band_kernel, 6, slot.output_buffer);
+        slot.kernel_event = enqueue_kernel(compute_queue, band_kernel, rows, width, block_sz, 1, &slot.write_event);
+
+        status = clEnqueueReadBuffer(download_queue, slot.output_buffer, CL_FALSE, 0, rows * width * sizeof(float),
+                                     result + row_from * width, 1, &slot.kernel_event, &slot.read_event);
+        check_status(status, "Could not enqueue read");
+        slot.busy = true;
+
+        clFlush(upload_queue);
+        clFlush(compute_queue);
+        clFlush(download_queue);
+    }
+
+    // bands still in flight, oldest first
+    for (size_t i = 0; i < BATCH_SLOTS; i++) {
+        auto &slot = slots[(band + i) % BATCH_SLOTS];
+        if (slot.busy) {
+            retire_band(slot, band_done, stats);
+        }
+    }
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (auto &slot : slots) {
+        clReleaseMemObject(slot.input_buffer);
+        clReleaseMemObject(slot.output_buffer);
+    }
+    clReleaseMemObject(filter_buffer);
+    clReleaseCommandQueue(upload_queue);
+    clReleaseCommandQueue(compute_queue);
+    clReleaseCommandQueue(download_queue);
+
+    return stats;
+}
@@ -0,0 +1,44 @@
+#ifndef AU_PARALLEL_COMPUTING_OPENCL_CONVOLUTION_H
+#define AU_PARALLEL_COMPUTING_OPENCL_CONVOLUTION_H
+
+#include <string>
+#include <vector>
+
+#include "convolution.h"
+
+/**
+ * Overrides the OpenCL device: an index in opencl_devices() or a part of its name.
+ * Without it CONVOLUTION_DEVICE environment variable is used, then the best ranked device.
+ * Must be called before the first convolution, device and program are set up only once.
+ */
+void set_opencl_device(const std::string &selector);
+
+// descriptions of all OpenCL devices, best first
+std::vector<std::string> opencl_devices();
+
+// true if there is an OpenCL device calculate_parallel can run on
+bool opencl_available();
+
+// result is mapped from the device buffer and handed to `consume` without a host copy
+void calculate_parallel(const float *matrix, const floats &kernel, size_t n, size_t m, kernel_type type,
+                        const result_consumer &consume);
+
+/**
+ * Convolves a stream of n*n matrices with one filter. Up to three frames are in flight:
+ * upload of frame k+1, kernels on frame k and readback of frame k-1 run on separate queues.
+ */
+batch_stats calculate_parallel_batch(const floats &kernel, size_t n, size_t m, kernel_type type,
+                                     const frame_reader &read_frame, const frame_writer &write_frame);
+
+/**
+ * Convolves a height x width matrix that need not fit in memory, band_rows rows at a time, into the
+ * height x width `result`; both are usually file mappings. Every band is uploaded with the m - 1 rows
+ * around it, so device memory is bounded by the band size and the result equals a whole convolution.
+ * Bands are pipelined like frames of calculate_parallel_batch, `band_done` gets them in order once
+ * their rows of `result` are written. Stats count bands as frames.
+ */
+batch_stats calculate_parallel_bands(const float *matrix, const floats &kernel, size_t height, size_t width, size_t m,
+                                     size_t band_rows, float *result, const band_consumer &band_done);
+
+
+#endif //AU_PARALLEL_COMPUTING_OPENCL_CONVOLUTION_H
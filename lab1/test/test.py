@@ -2,6 +2,7 @@ import numpy as np
 from scipy.signal import convolve2d
 import subprocess
 import os, errno
+import sys
 
 
 def silentremove(filename):
@@ -44,6 +45,10 @@ def check(expected, actual):
         return False
 
 
+# extra command line arguments are passed to the executable, e.g. `python test.py -k naive`
+CONVOLUTION = ' '.join(['./convolution'] + sys.argv[1:])
+
+
 def make_test(test):
     if not hasattr(make_test, "tests"):
         make_test.tests = []
@@ -58,7 +63,7 @@ def make_test(test):
         try:
             with open('input.txt', 'w') as input_file:
                 write_test(a, b, input_file)
-            subprocess.call('./convolution', shell=True)
+            subprocess.call(CONVOLUTION, shell=True)
             with open('output.txt') as output_file:
                 actual = read_matrix(output_file)
                 if check(expected, actual):
@@ -81,6 +86,16 @@ def sqr_ones(n):
     return np.ones((n, n))
 
 
+def sqr_random(n):
+    return np.random.uniform(-1, 1, (n, n)).astype(np.float32)
+
+
+def sqr_random_symmetric(n):
+    # convolute computes correlation, so the kernel has to be symmetric to compare against convolve2d
+    b = sqr_random(n)
+    return (b + b[::-1, ::-1]) / 2
+
+
 @make_test
 def test_5x3():
     return sqr_ones(5), sqr_ones(3)
@@ -111,6 +126,23 @@ def test_1023x9():
     return sqr_ones(1023), sqr_ones(9)
 
 
+@make_test
+def test_random_100x5():
+    return sqr_random(100), sqr_random_symmetric(5)
+
+
+# large filters, taken by the FFT unless `-a direct` is given;
+# scaled, so that the printed results keep the precision `check` needs
+@make_test
+def test_random_200x31():
+    return sqr_random(200), sqr_random_symmetric(31) / 31
+
+
+@make_test
+def test_random_300x101():
+    return sqr_random(300), sqr_random_symmetric(101) / 101
+
+
 def main():
     
     print ('tip: Please, run this tests in the same folder as executable is\n')
@@ -0,0 +1,419 @@
+#ifdef HAVE_OPENCL
+#ifdef __APPLE__
+#include <OpenCL/cl.hpp>
+#else
+
+#include <CL/cl.hpp>
+
+#endif
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+
+#include "cpu_scan.h"
+#ifdef HAVE_OPENCL
+#include "prefixsum_kernel.cl.h"
+#include "primitives.h"
+#include "primitives_kernel.cl.h"
+#include "scan.h"
+#endif
+
+/**
+ * Inclusive float sum scans of n elements and the primitives built on them (primitives.h) against their
+ * std counterparts. Bytes are the input read and the output written, items are elements.
+ * OpenCL cases time the work on device buffers only, as `prefixsum` logs it, on the device `prefixsum` picks:
+ * the last one of the first platform that has any. Programs come from the binary cache after the first run.
+ * Partition and compaction keep the floats below PIVOT, histograms have HISTOGRAM_BINS bins over [0, 1).
+ * Before timing, every OpenCL case checks its result once against scan_cpu or its std counterpart and fails
+ * if it differs.
+ */
+namespace {
+    const std::vector<long> SIZES = {1 << 16, 1 << 20, 1 << 24};
+    // largest elements of a work-group block, the device may allow less
+    const std::vector<long> BLOCK_SIZES = {256, 1024, 4096};
+    const float PIVOT = 0.5f;
+    const unsigned HISTOGRAM_BINS = 256;
+
+    std::vector<float> random_array(size_t n) {
+        std::mt19937 generator(42);
+        std::uniform_real_distribution<float> distribution(0, 1);
+        std::vector<float> array(n);
+        for (auto &x : array) {
+            x = distribution(generator);
+        }
+        return array;
+    }
+
+    std::vector<uint32_t> random_keys(size_t n) {
+        std::mt19937 generator(42);
+        std::vector<uint32_t> keys(n);
+        for (auto &x : keys) {
+            x = generator();
+        }
+        return keys;
+    }
+
+    // counts of HISTOGRAM_BINS bins over [0, 1)
+    void count_bins(const std::vector<float> &input, std::vector<uint32_t> &counts) {
+        std::fill(counts.begin(), counts.end(), 0);
+        for (auto x : input) {
+            if (x >= 0 && x < 1) {
+                counts[std::min((unsigned) (x * HISTOGRAM_BINS), HISTOGRAM_BINS - 1)]++;
+            }
+        }
+    }
+
+    void set_processed(benchmark::state &state, size_t n) {
+        state.set_bytes_processed(2.0 * n * sizeof(float));
+        state.set_items_processed((double) n, "elements");
+    }
+
+    void cpu_scan(benchmark::state &state) {
+        size_t n = state.range(0);
+        auto input = random_array(n);
+        std::vector<float> output(n);
+
+        while (state.keep_running()) {
+            scan_cpu<float, scan::plus>(input.data(), nullptr, output.data(), n, false);
+        }
+        set_processed(state, n);
+    }
+
+    // sorts a fresh copy of the input every iteration, the copy is not timed
+    template<class T>
+    void std_sort(benchmark::state &state, const std::vector<T> &input) {
+        std::vector<T> keys;
+        while (state.keep_running()) {
+            state.pause_timing();
+            keys = input;
+            state.resume_timing();
+            std::sort(keys.begin(), keys.end());
+        }
+        set_processed(state, input.size());
+    }
+
+    void std_sort_uint(benchmark::state &state) {
+        std_sort(state, random_keys(state.range(0)));
+    }
+
+    void std_sort_float(benchmark::state &state) {
+        std_sort(state, random_array(state.range(0)));
+    }
+
+    void std_partition(benchmark::state &state) {
+        size_t n = state.range(0);
+        auto input = random_array(n);
+        std::vector<float> values;
+        while (state.keep_running()) {
+            state.pause_timing();
+            values = input;
+            state.resume_timing();
+            std::partition(values.begin(), values.end(), [](float x) { return scan::less::apply(x, PIVOT); });
+        }
+        set_processed(state, n);
+    }
+
+    void std_copy_if(benchmark::state &state) {
+        size_t n = state.range(0);
+        auto input = random_array(n);
+        std::vector<float> output(n);
+        while (state.keep_running()) {
+            std::copy_if(input.begin(), input.end(), output.begin(), [](float x) { return scan::less::apply(x, PIVOT); });
+        }
+        set_processed(state, n);
+    }
+
+    void cpu_histogram(benchmark::state &state) {
+        size_t n = state.range(0);
+        auto input = random_array(n);
+        std::vector<uint32_t> counts(HISTOGRAM_BINS);
+        while (state.keep_running()) {
+            count_bins(input, counts);
+        }
+        set_processed(state, n);
+    }
+
+#ifdef HAVE_OPENCL
+    // the device prefixsum would use, false if there is none
+    bool find_device(cl::Device &device) {
+        std::vector<cl::Platform> platforms;
+        cl::Platform::get(&platforms);
+        for (auto &platform : platforms) {
+            std::vector<cl::Device> devices;
+            platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+            if (!devices.empty()) {
+                device = devices.back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template<class T>
+    std::vector<T> read_buffer(cl::CommandQueue &queue, const cl::Buffer &buffer, size_t n) {
+        std::vector<T> values(n);
+        if (n != 0) {
+            queue.enqueueReadBuffer(buffer, CL_TRUE, 0, n * sizeof(T), values.data());
+        }
+        return values;
+    }
+
+    /**
+     * Checks the scans of `type` against scan_cpu, fails the case if any differs. Exclusive and segmented scans
+     * are single-pass only. The values are zeros and ones, so that every sum up to 2^24 elements is exact in floats
+     * and does not depend on the order of the additions.
+     */
+    bool check_opencl_scans(benchmark::state &state, const cl::Context &context, cl::CommandQueue &queue,
+                            scan::scanner &scanner, size_t n, scan::algorithm type) {
+        std::mt19937 generator(42);
+        std::vector<float> input(n);
+        std::vector<cl_uchar> flags(n);
+        for (size_t i = 0; i < n; i++) {
+            input[i] = (float) (generator() & 1);
+            // segments of 64 elements on average, some of them span work-group blocks
+            flags[i] = generator() % 64 == 0;
+        }
+        cl::Buffer input_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * sizeof(float), input.data());
+        cl::Buffer flags_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n, flags.data());
+        cl::Buffer output_buffer(context, CL_MEM_READ_WRITE, n * sizeof(float));
+        std::vector<float> expected(n);
+
+        for (int segmented = 0; segmented < 2; segmented++) {
+            for (int exclusive = 0; exclusive < 2; exclusive++) {
+                if (type == scan::algorithm::tree && (segmented || exclusive)) {
+                    continue;
+                }
+                if (segmented) {
+                    if (exclusive) {
+                        scanner.segmented_exclusive_scan<float>(input_buffer, flags_buffer, output_buffer, n);
+                    } else {
+                        scanner.segmented_inclusive_scan<float>(input_buffer, flags_buffer, output_buffer, n);
+                    }
+                } else if (exclusive) {
+                    scanner.exclusive_scan<float>(input_buffer, output_buffer, n);
+                } else {
+                    scanner.inclusive_scan<float>(input_buffer, output_buffer, n, type);
+                }
+                scan_cpu<float, scan::plus>(input.data(), segmented ? flags.data() : nullptr, expected.data(), n,
+                                            exclusive != 0);
+                if (read_buffer<float>(queue, output_buffer, n) != expected) {
+                    state.fail(std::string(segmented ? "segmented " : "") + (exclusive ? "exclusive" : "inclusive")
+                               + " scan differs from scan_cpu");
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    benchmark::function opencl_scan(scan::algorithm type) {
+        return [type](benchmark::state &state) {
+            cl::Device device;
+            if (!find_device(device)) {
+                state.skip("no OpenCL device");
+                return;
+            }
+            size_t n = state.range(0);
+            cl::Context context(std::vector<cl::Device>{device});
+            cl::CommandQueue queue(context, device);
+            scan::scanner scanner(context, device, queue, prefixsum_kernel_source);
+            scanner.set_max_block_size(state.range(1));
+            state.set_label(device.getInfo<CL_DEVICE_NAME>() + ", block " +
+                            std::to_string(scanner.block_size<float>()));
+            if (!check_opencl_scans(state, context, queue, scanner, n, type)) {
+                return;
+            }
+
+            auto input = random_array(n);
+            cl::Buffer input_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * sizeof(float),
+                                    input.data());
+            cl::Buffer output_buffer(context, CL_MEM_READ_WRITE, n * sizeof(float));
+
+            while (state.keep_running()) {
+                scanner.inclusive_scan<float>(input_buffer, output_buffer, n, type);
+                queue.finish();
+            }
+            set_processed(state, n);
+        };
+    }
+
+    typedef std::function<void(benchmark::state &, const cl::Context &, cl::CommandQueue &,
+                               scan::primitives &)> primitive_case;
+
+    // runs the case with primitives on the device prefixsum would use
+    benchmark::function opencl_primitive(primitive_case run) {
+        return [run](benchmark::state &state) {
+            cl::Device device;
+            if (!find_device(device)) {
+                state.skip("no OpenCL device");
+                return;
+            }
+            cl::Context context(std::vector<cl::Device>{device});
+            cl::CommandQueue queue(context, device);
+            scan::primitives primitives(context, device, queue, prefixsum_kernel_source, primitives_kernel_source);
+            state.set_label(device.getInfo<CL_DEVICE_NAME>());
+            run(state, context, queue, primitives);
+        };
+    }
+
+    // ascending order of the sort, -0 before +0
+    bool sort_less(float a, float b) {
+        return a < b || (a == b && std::signbit(a) && !std::signbit(b));
+    }
+
+    bool sort_less(uint32_t a, uint32_t b) {
+        return a < b;
+    }
+
+    // the input with both signs, both zeros and both infinities, so that the mapping of floats to keys is checked
+    std::vector<cl_float> sort_check_input(std::vector<cl_float> input) {
+        for (size_t i = 0; i < input.size(); i += 2) {
+            input[i] = -input[i];
+        }
+        const cl_float special[] = {-0.f, 0.f, std::numeric_limits<float>::infinity(),
+                                    -std::numeric_limits<float>::infinity(), -0.f};
+        std::copy(special, special + std::min(input.size(), sizeof(special) / sizeof(special[0])), input.begin());
+        return input;
+    }
+
+    std::vector<cl_uint> sort_check_input(std::vector<cl_uint> input) {
+        return input;
+    }
+
+    // sorts a fresh copy of the input every iteration, the device-side copy is not timed
+    template<class T>
+    void opencl_sort(benchmark::state &state, const cl::Context &context, cl::CommandQueue &queue,
+                     scan::primitives &primitives, std::vector<T> input) {
+        size_t n = input.size();
+        auto check = sort_check_input(input);
+        cl::Buffer keys(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, n * sizeof(T), check.data());
+        primitives.sort<T>(keys, n);
+        auto sorted = read_buffer<T>(queue, keys, n);
+        std::sort(check.begin(), check.end(), [](T a, T b) { return sort_less(a, b); });
+        if (std::memcmp(sorted.data(), check.data(), n * sizeof(T)) != 0) {
+            state.fail("keys differ from std::sort");
+            return;
+        }
+
+        cl::Buffer input_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * sizeof(T), input.data());
+        while (state.keep_running()) {
+            state.pause_timing();
+            queue.enqueueCopyBuffer(input_buffer, keys, 0, 0, n * sizeof(T));
+            queue.finish();
+            state.resume_timing();
+            primitives.sort<T>(keys, n);
+            queue.finish();
+        }
+        set_processed(state, n);
+    }
+
+    void opencl_sort_uint(benchmark::state &state, const cl::Context &context, cl::CommandQueue &queue,
+                          scan::primitives &primitives) {
+        opencl_sort<cl_uint>(state, context, queue, primitives, random_keys(state.range(0)));
+    }
+
+    void opencl_sort_float(benchmark::state &state, const cl::Context &context, cl::CommandQueue &queue,
+                           scan::primitives &primitives) {
+        opencl_sort<cl_float>(state, context, queue, primitives, random_array(state.range(0)));
+    }
+
+    // compaction, or partition if `partition` is set
+    primitive_case opencl_split(bool partition) {
+        return [partition](benchmark::state &state, const cl::Context &context, cl::CommandQueue &queue,
+                           scan::primitives &primitives) {
+            size_t n = state.range(0);
+            auto input = random_array(n);
+            cl::Buffer input_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * sizeof(float),
+                                    input.data());
+            cl::Buffer output_buffer(context, CL_MEM_READ_WRITE, n * sizeof(float));
+            cl::Buffer count(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+            auto run = [&]() {
+                if (partition) {
+                    primitives.partition<cl_float, scan::less>(input_buffer, output_buffer, count, n, PIVOT);
+                } else {
+                    primitives.compact<cl_float, scan::less>(input_buffer, output_buffer, count, n, PIVOT);
+                }
+            };
+
+            run();
+            auto less = [](float x) { return scan::less::apply(x, PIVOT); };
+            std::vector<float> expected;
+            std::copy_if(input.begin(), input.end(), std::back_inserter(expected), less);
+            size_t expected_count = expected.size();
+            if (partition) {
+                expected = input;
+                std::stable_partition(expected.begin(), expected.end(), less);
+            }
+            auto output = read_buffer<float>(queue, output_buffer, expected.size());
+            if (read_buffer<cl_uint>(queue, count, 1)[0] != expected_count) {
+                state.fail("count differs from std::copy_if");
+                return;
+            }
+            if (output != expected) {
+                state.fail(std::string("output differs from ") + (partition ? "std::stable_partition" : "std::copy_if"));
+                return;
+            }
+
+            while (state.keep_running()) {
+                run();
+                queue.finish();
+            }
+            set_processed(state, n);
+        };
+    }
+
+    void opencl_histogram(benchmark::state &state, const cl::Context &context, cl::CommandQueue &queue,
+                          scan::primitives &primitives) {
+        size_t n = state.range(0);
+        auto input = random_array(n);
+        cl::Buffer input_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * sizeof(float), input.data());
+        cl::Buffer counts(context, CL_MEM_READ_WRITE, HISTOGRAM_BINS * sizeof(cl_uint));
+
+        primitives.histogram<cl_float>(input_buffer, counts, n, HISTOGRAM_BINS, 0.f, 1.f);
+        std::vector<uint32_t> expected(HISTOGRAM_BINS);
+        count_bins(input, expected);
+        if (read_buffer<cl_uint>(queue, counts, HISTOGRAM_BINS) != expected) {
+            state.fail("counts differ from the CPU histogram");
+            return;
+        }
+
+        while (state.keep_running()) {
+            primitives.histogram<cl_float>(input_buffer, counts, n, HISTOGRAM_BINS, 0.f, 1.f);
+            queue.finish();
+        }
+        set_processed(state, n);
+    }
+#endif
+}
+
+int main(int argc, char **argv) {
+    benchmark::add("cpu", cpu_scan).ranges({{"n", SIZES}});
+    benchmark::add("std_sort_uint32", std_sort_uint).ranges({{"n", SIZES}});
+    benchmark::add("std_sort_float", std_sort_float).ranges({{"n", SIZES}});
+    benchmark::add("std_partition", std_partition).ranges({{"n", SIZES}});
+    benchmark::add("std_copy_if", std_copy_if).ranges({{"n", SIZES}});
+    benchmark::add("cpu_histogram", cpu_histogram).ranges({{"n", SIZES}});
+#ifdef HAVE_OPENCL
+    benchmark::add("opencl_single_pass", opencl_scan(scan::algorithm::single_pass))
+            .ranges({{"n", SIZES}, {"block", BLOCK_SIZES}});
+    benchmark::add("opencl_tree", opencl_scan(scan::algorithm::tree)).ranges({{"n", SIZES}, {"block", BLOCK_SIZES}});
+    benchmark::add("opencl_sort_uint32", opencl_primitive(opencl_sort_uint)).ranges({{"n", SIZES}});
+    benchmark::add("opencl_sort_float", opencl_primitive(opencl_sort_float)).ranges({{"n", SIZES}});
+    benchmark::add("opencl_partition", opencl_primitive(opencl_split(true))).ranges({{"n", SIZES}});
+    benchmark::add("opencl_compact", opencl_primitive(opencl_split(false))).ranges({{"n", SIZES}});
+    benchmark::add("opencl_histogram", opencl_primitive(opencl_histogram)).ranges({{"n", SIZES}});
+#endif
+    return benchmark::run(argc, argv);
+}
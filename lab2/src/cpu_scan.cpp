@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "cpu_scan.h"
+
+namespace {
+    // smaller chunks are not worth a thread
+    const unsigned long MIN_CHUNK = 1 << 16;
+
+    // total of a chunk; a segmented total only has the elements after the last segment start
+    template<class T>
+    struct chunk_total {
+        T value;
+        bool flag;
+    };
+
+    template<class T, class Op>
+    chunk_total<T> reduce(const T *input, const uint8_t *flags, unsigned long n) {
+        chunk_total<T> total = {Op::template identity<T>(), false};
+        unsigned long from = 0;
+        if (flags != nullptr) {
+            for (unsigned long i = n; i-- > 0;) {
+                if (flags[i]) {
+                    total.flag = true;
+                    from = i;
+                    break;
+                }
+            }
+        }
+        for (unsigned long i = from; i < n; i++) {
+            total.value = Op::apply(total.value, input[i]);
+        }
+        return total;
+    }
+
+    // scans n elements starting from `carry`, returns the carry after the last element
+    template<class T, class Op>
+    T scan_scalar(const T *input, const uint8_t *flags, T *output, unsigned long n, T carry, bool exclusive) {
+        for (unsigned long i = 0; i < n; i++) {
+            if (flags != nullptr && flags[i]) {
+                carry = Op::template identity<T>();
+            }
+            T value = input[i];
+            T next = Op::apply(carry, value);
+            output[i] = exclusive ? carry : next;
+            carry = next;
+        }
+        return carry;
+    }
+
+    // sums that are not segmented go through SIMD registers, everything else is scalar
+    template<class T, class Op>
+    T scan_chunk(const T *input, const uint8_t *flags, T *output, unsigned long n, T carry, bool exclusive) {
+        return scan_scalar<T, Op>(input, flags, output, n, carry, exclusive);
+    }
+
+#if defined(__SSE2__)
+    // in-register inclusive prefix sum of 4 floats: two shift-and-add steps
+    inline __m128 prefix4(__m128 x) {
+        x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+        return _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+    }
+
+    float scan_float_sse(const float *input, float *output, unsigned long n, float carry, bool exclusive,
+                         unsigned long &i) {
+        __m128 carry4 = _mm_set1_ps(carry);
+        for (; i + 4 <= n; i += 4) {
+            __m128 prefix = prefix4(_mm_loadu_ps(input + i));
+            __m128 shifted = _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(prefix), 4));
+            _mm_storeu_ps(output + i, _mm_add_ps(carry4, exclusive ? shifted : prefix));
+            carry4 = _mm_add_ps(carry4, _mm_shuffle_ps(prefix, prefix, _MM_SHUFFLE(3, 3, 3, 3)));
+        }
+        return _mm_cvtss_f32(carry4);
+    }
+#endif
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define AVX_DISPATCH
+#define AVX_TARGET __attribute__((target("avx")))
+    // in-register inclusive prefix sum of 8 floats: shift-and-add inside the 128-bit lanes,
+    // then the lower lane's total is added to the upper lane
+    AVX_TARGET inline __m256 prefix8(__m256 x) {
+        const __m256 zero = _mm256_setzero_ps();
+        x = _mm256_add_ps(x, _mm256_blend_ps(_mm256_permute_ps(x, _MM_SHUFFLE(2, 1, 0, 3)), zero, 0x11));
+        x = _mm256_add_ps(x, _mm256_blend_ps(_mm256_permute_ps(x, _MM_SHUFFLE(1, 0, 3, 2)), zero, 0x33));
+        __m256 lane_totals = _mm256_permute_ps(x, _MM_SHUFFLE(3, 3, 3, 3));
+        return _mm256_add_ps(x, _mm256_permute2f128_ps(lane_totals, lane_totals, 0x08));
+    }
+
+    // elements shifted one position up, zero comes in
+    AVX_TARGET inline __m256 shift8(__m256 x) {
+        __m256 rotated = _mm256_permute_ps(x, _MM_SHUFFLE(2, 1, 0, 3));
+        return _mm256_blend_ps(rotated, _mm256_permute2f128_ps(rotated, rotated, 0x08), 0x11);
+    }
+
+    AVX_TARGET float scan_float_avx(const float *input, float *output, unsigned long n, float carry,
+                                    bool exclusive, unsigned long &i) {
+        __m256 carry8 = _mm256_set1_ps(carry);
+        for (; i + 8 <= n; i += 8) {
+            __m256 prefix = prefix8(_mm256_loadu_ps(input + i));
+            __m256 result = _mm256_add_ps(carry8, exclusive ? shift8(prefix) : prefix);
+            carry8 = _mm256_add_ps(carry8, _mm256_permute2f128_ps(prefix, prefix, 0x11));
+            carry8 = _mm256_permute_ps(carry8, _MM_SHUFFLE(3, 3, 3, 3));
+            _mm256_storeu_ps(output + i, result);
+        }
+        return _mm_cvtss_f32(_mm256_castps256_ps128(carry8));
+    }
+#endif
+
+#if defined(__SSE2__)
+    // the AVX loop is compiled into every build and taken on CPUs that have AVX, the SSE one otherwise
+    template<>
+    float scan_chunk<float, scan::plus>(const float *input, const uint8_t *flags, float *output, unsigned long n,
+                                        float carry, bool exclusive) {
+        unsigned long i = 0;
+        if (flags == nullptr) {
+#ifdef AVX_DISPATCH
+            static const bool avx = __builtin_cpu_supports("avx");
+            carry = avx ? scan_float_avx(input, output, n, carry, exclusive, i)
+                        : scan_float_sse(input, output, n, carry, exclusive, i);
+#else
+            carry = scan_float_sse(input, output, n, carry, exclusive, i);
+#endif
+        }
+        return scan_scalar<float, scan::plus>(input + i, flags == nullptr ? nullptr : flags + i, output + i,
+                                              n - i, carry, exclusive);
+    }
+#endif
+
+#if defined(__SSE2__)
+    // in-register inclusive prefix sum of 4 ints: two shift-and-add steps
+    inline __m128i prefix4(__m128i x) {
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        return _mm_add_epi32(x, _mm_slli_si128(x, 8));
+    }
+
+    template<>
+    int32_t scan_chunk<int32_t, scan::plus>(const int32_t *input, const uint8_t *flags, int32_t *output,
+                                            unsigned long n, int32_t carry, bool exclusive) {
+        unsigned long i = 0;
+        if (flags == nullptr) {
+            __m128i carry4 = _mm_set1_epi32(carry);
+            for (; i + 4 <= n; i += 4) {
+                __m128i prefix = prefix4(_mm_loadu_si128((const __m128i *) (input + i)));
+                __m128i result = _mm_add_epi32(carry4, exclusive ? _mm_slli_si128(prefix, 4) : prefix);
+                _mm_storeu_si128((__m128i *) (output + i), result);
+                carry4 = _mm_add_epi32(carry4, _mm_shuffle_epi32(prefix, _MM_SHUFFLE(3, 3, 3, 3)));
+            }
+            carry = _mm_cvtsi128_si32(carry4);
+        }
+        return scan_scalar<int32_t, scan::plus>(input + i, flags == nullptr ? nullptr : flags + i, output + i,
+                                                n - i, carry, exclusive);
+    }
+#endif
+
+    template<class T, class Op>
+    void scan_part(const T *input, const uint8_t *flags, T *output, unsigned long from, unsigned long to,
+                   T carry, bool exclusive) {
+        scan_chunk<T, Op>(input + from, flags == nullptr ? nullptr : flags + from, output + from, to - from,
+                          carry, exclusive);
+    }
+}
+
+template<class T, class Op>
+void scan_cpu(const T *input, const uint8_t *flags, T *output, unsigned long n, bool exclusive) {
+    unsigned long threads_num = std::max(1u, std::thread::hardware_concurrency());
+    threads_num = std::max(1ul, std::min(threads_num, n / MIN_CHUNK));
+    const unsigned long chunk = (n + threads_num - 1) / threads_num;
+
+    if (threads_num == 1) {
+        scan_chunk<T, Op>(input, flags, output, n, Op::template identity<T>(), exclusive);
+        return;
+    }
+
+    std::vector<chunk_total<T>> totals(threads_num);
+    std::vector<std::thread> threads;
+    for (unsigned long t = 0; t < threads_num; t++) {
+        const unsigned long from = std::min(n, t * chunk);
+        const unsigned long to = std::min(n, from + chunk);
+        threads.emplace_back([=, &totals]() {
+            totals[t] = reduce<T, Op>(input + from, flags == nullptr ? nullptr : flags + from, to - from);
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+
+    // carry into every chunk: the scanned totals of the chunks on its left
+    T carry = Op::template identity<T>();
+    for (unsigned long t = 0; t < threads_num; t++) {
+        const unsigned long from = std::min(n, t * chunk);
+        const unsigned long to = std::min(n, from + chunk);
+        threads.emplace_back(scan_part<T, Op>, input, flags, output, from, to, carry, exclusive);
+        carry = totals[t].flag ? totals[t].value : Op::apply(carry, totals[t].value);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+#define INSTANTIATE_SCAN_CPU(T) \
+    template void scan_cpu<T, scan::plus>(const T *, const uint8_t *, T *, unsigned long, bool); \
+    template void scan_cpu<T, scan::maximum>(const T *, const uint8_t *, T *, unsigned long, bool); \
+    template void scan_cpu<T, scan::minimum>(const T *, const uint8_t *, T *, unsigned long, bool);
+
+INSTANTIATE_SCAN_CPU(int32_t)
+INSTANTIATE_SCAN_CPU(int64_t)
+INSTANTIATE_SCAN_CPU(float)
+INSTANTIATE_SCAN_CPU(double)
@@ -0,0 +1,22 @@
+#ifndef AU_PARALLEL_COMPUTING_CPU_SCAN_H
+#define AU_PARALLEL_COMPUTING_CPU_SCAN_H
+
+#include <cstdint>
+
+#include "operators.h"
+
+/**
+ * Native counterpart of scan::scanner with the same kinds of scans. The array is split into
+ * one chunk per hardware thread: every thread reduces its chunk, the chunk totals are scanned,
+ * then every thread scans its chunk again starting from the scanned total on its left.
+ * Float and int sums are scanned 4 elements at a time in SSE registers, float sums 8 at a time
+ * in AVX registers where the CPU has AVX (checked at runtime, the build needs no -mavx).
+ * `flags` is nullptr for scans that are not segmented, `input` and `output` may be the same.
+ *
+ * Instantiated for int32_t, int64_t, float and double with plus, maximum and minimum.
+ */
+template<class T, class Op>
+void scan_cpu(const T *input, const uint8_t *flags, T *output, unsigned long n, bool exclusive);
+
+
+#endif //AU_PARALLEL_COMPUTING_CPU_SCAN_H
@@ -1,9 +1,11 @@
+#ifdef HAVE_OPENCL
 #ifdef __APPLE__
 #include <OpenCL/cl.hpp>
 #else
 
 #include <CL/cl.hpp>
 
+#endif
 #endif
 
 #include <vector>
@@ -11,29 +13,28 @@
 #include <string>
 #include <memory>
 #include <ostream>
+#include <iterator>
 #include <iostream>
-#include <cassert>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <chrono>
 
-using namespace cl;
+#include "binary_io.h"
+#include "cpu_scan.h"
 
-namespace {
-    const char *NVIDIA = "NVIDIA";
-#define PROGRAM "prefixsum"
-    const char *kernel_program = PROGRAM "_kernel.cl";
-    const char *kernel_function = PROGRAM;
-#undef  PROGRAM
+#ifdef HAVE_OPENCL
+#include "prefixsum_kernel.cl.h"
+#include "scan.h"
 
-    const int BLOCK_SZ = 2;
-    const int MAXN = 1048576;
+using namespace cl;
+#endif
 
+namespace {
     const char *INPUT = "input.txt";
     const char *OUTPUT = "output.txt";
     const char *LOG = "prefixsum.log";
 
-    typedef std::vector<float> floats;
-
-    const unsigned long FLOAT_SZ = sizeof(float);
-
     class DumpLogger {
     public:
         DumpLogger(std::string fname) : log(fname) {}
@@ -44,116 +45,368 @@ namespace {
         std::ofstream log;
     } logger(LOG);
 
+    enum class backend_type {
+        automatic, opencl, cpu
+    };
+
+    backend_type parse_backend_type(const std::string &name) {
+        if (name == "auto") return backend_type::automatic;
+        if (name == "opencl") return backend_type::opencl;
+        if (name == "cpu") return backend_type::cpu;
+        throw std::invalid_argument("Unknown backend " + name);
+    }
+
+    scan::algorithm parse_algorithm(const std::string &name) {
+        if (name == "tree") return scan::algorithm::tree;
+        if (name == "single-pass") return scan::algorithm::single_pass;
+        throw std::invalid_argument("Unknown scan algorithm " + name);
+    }
 
-    typedef make_kernel<Buffer &, Buffer &, LocalSpaceArg, LocalSpaceArg, Buffer &> kf_block_sum;
-    typedef make_kernel<Buffer &, Buffer &> kf_array_sum;
+    enum class value_type {
+        float32, int32, int64, float64
+    };
 
-    CommandQueue g_queue;
-    Context g_context;
-    std::shared_ptr<kf_block_sum> kf_sum_blocks;
-    std::shared_ptr<kf_array_sum> kf_sum_array;
+    value_type parse_value_type(const std::string &name) {
+        if (name == "float") return value_type::float32;
+        if (name == "int") return value_type::int32;
+        if (name == "long") return value_type::int64;
+        if (name == "double") return value_type::float64;
+        throw std::invalid_argument("Unknown value type " + name);
+    }
+
+    enum class operator_type {
+        sum, max, min
+    };
+
+    operator_type parse_operator_type(const std::string &name) {
+        if (name == "sum") return operator_type::sum;
+        if (name == "max") return operator_type::max;
+        if (name == "min") return operator_type::min;
+        throw std::invalid_argument("Unknown operator " + name);
+    }
+
+    // what to scan, from the command line
+    struct scan_options {
+        backend_type backend = backend_type::automatic;
+        scan::algorithm algorithm = scan::algorithm::single_pass;
+        value_type type = value_type::float32;
+        operator_type op = operator_type::sum;
+        bool exclusive = false;
+        // segment flags file, the scan is not segmented if it is empty
+        std::string segments;
+        // scan only the first `length` elements of the input, all of them if it is zero
+        unsigned long length = 0;
+        // largest OpenCL work-group block in elements, the device decides if it is zero
+        unsigned long block = 0;
+    };
+
+    void usage(char const *name) {
+        std::cerr << "Usage: " << name
+                  << " [-b auto|opencl|cpu] [-m tree|single-pass] [-n length] [-t float|int|long|double]"
+                  << " [-o sum|max|min] [-x inclusive|exclusive] [-s flags] [-B block]" << std::endl
+                  << "  -b  where to scan, OpenCL if there is a device by default" << std::endl
+                  << "  -m  scan algorithm, single-pass by default, tree only does inclusive scans" << std::endl
+                  << "  -n  scan only the first `length` elements of the input" << std::endl
+                  << "  -t  element type, float by default" << std::endl
+                  << "  -o  scan operator, sum by default" << std::endl
+                  << "  -x  inclusive (default) or exclusive scan" << std::endl
+                  << "  -s  segmented scan, `flags` has the format of the input and one flag per element,"
+                  << " a non-zero flag starts a segment" << std::endl
+                  << "  -B  elements an OpenCL work-group scans at most, as many as the device allows by default"
+                  << std::endl;
+    }
 }
 
+#ifdef HAVE_OPENCL
+// devices of the first platform that has any, empty if there are none
 std::vector<Device> get_decices() {
     std::vector<Platform> platforms;
     Platform::get(&platforms);
-
     logger.error(platforms.empty(), "No platforms found");
-    assert(!platforms.empty());
-
-    Platform platform = platforms[0];
-    logger.info("Using platform " + platform.getInfo<CL_PLATFORM_NAME>());
 
     std::vector<Device> devices;
-    platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+    for (auto &platform : platforms) {
+        platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+        if (!devices.empty()) {
+            logger.info("Using platform " + platform.getInfo<CL_PLATFORM_NAME>());
+            break;
+        }
+    }
     logger.error(devices.empty(), "No devices found");
-    assert(!devices.empty());
 
     return devices;
 }
+#endif
 
-Program::Sources get_sources() {
-    std::ifstream file(kernel_program);
-    std::string source_code((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    Program::Sources sources;
-    sources.push_back({source_code.c_str(), source_code.length()});
-    return sources;
+/**
+ * Input array. Text input is parsed into `text_array`, binary input (one record of the scanned type)
+ * is mapped and `array` points straight into the mapping.
+ */
+template<class T>
+struct input_data {
+    std::unique_ptr<binary_io::reader> binary;
+    std::vector<T> text_array;
+    const T *array;
+    unsigned long n;
+};
+
+// `length` limits the array to its first elements, all of them are used if it is zero,
+// an input shorter than `length` throws binary_io::error
+template<class T>
+void read_input(const std::string &path, input_data<T> &input, unsigned long length) {
+    if (binary_io::is_binary(path)) {
+        input.binary.reset(new binary_io::reader(path));
+        binary_io::array_view array;
+        auto found = input.binary->next(array);
+        if (!found || array.type != binary_io::dtype_of<T>() || array.dims.size() != 1) {
+            throw binary_io::error(path + ": binary input must contain one array of the scanned type");
+        }
+        input.n = array.dims[0];
+        input.array = (const T *) array.data;
+    } else {
+        unsigned long n = 0;
+        std::ifstream in(path);
+        in >> n;
+        if (length != 0) {
+            n = std::min(n, length);
+        }
+        input.text_array.resize(n);
+        for (unsigned long i = 0; i < n; i++) {
+            // flags are read as numbers, not characters
+            typename std::conditional<sizeof(T) == 1, int, T>::type value;
+            in >> value;
+            input.text_array[i] = (T) value;
+        }
+        input.n = n;
+        input.array = input.text_array.data();
+    }
+    if (length > input.n) {
+        throw binary_io::error(path + ": " + std::to_string(input.n) + " elements, shorter than the requested "
+                               + std::to_string(length));
+    }
+    if (length != 0) {
+        input.n = length;
+    }
 }
 
-floats read_input() {
-    int n;
-    std::ifstream in(INPUT);
-    in >> n;
-    floats array((unsigned long) n);
-    assert (n >= 0 && n <= MAXN && "Invalid array size");
-    for (int i = 0; i < n; i++) {
-        in >> array[i];
+// segment flags, one per element of an input of `n` elements, `length` limits them like the input
+void read_flags(const std::string &path, input_data<uint8_t> &flags, unsigned long length, unsigned long n) {
+    read_input(path, flags, length);
+    if (flags.n != n) {
+        throw binary_io::error(path + ": " + std::to_string(flags.n) + " flags for an input of "
+                               + std::to_string(n) + " elements");
     }
-    return array;
 }
 
-void write_output(const floats &array) {
-    std::ofstream out(OUTPUT);
-    std::copy(array.begin(), array.end(), std::ostream_iterator<float>(out, " "));
+// output has the format of the input
+template<class T>
+void write_output(const T *array, unsigned long n, bool binary) {
+    if (binary) {
+        binary_io::writer out(OUTPUT);
+        out.write(binary_io::dtype_of<T>(), {n}, array);
+    } else {
+        std::ofstream out(OUTPUT);
+        std::copy(array, array + n, std::ostream_iterator<T>(out, " "));
+    }
 }
 
-inline floats copy_from_buffer(Buffer& buffer, unsigned long n) {
-    floats blocks_sums(n);
-    g_queue.enqueueReadBuffer(buffer, CL_TRUE, 0, FLOAT_SZ * n, blocks_sums.data());
-    return blocks_sums;
+void log_time(const char *backend, std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    logger.info(std::string(backend) + " scan time: " + std::to_string(seconds.count()) + "s");
 }
 
-floats prefixsum(const floats &array) {
+template<class T, class Op>
+void run_cpu_scan(const scan_options &options) {
+    input_data<T> input;
+    read_input(INPUT, input, options.length);
 
-    constexpr unsigned long local_memory_sz = FLOAT_SZ * BLOCK_SZ;
-    unsigned long block_num = ((array.size() + BLOCK_SZ - 1) / BLOCK_SZ);
-    unsigned long sz_expanded = BLOCK_SZ * block_num;
+    input_data<uint8_t> flags;
+    if (!options.segments.empty()) {
+        read_flags(options.segments, flags, options.length, input.n);
+    }
 
-    Buffer input_buffer(g_context, CL_MEM_READ_ONLY, FLOAT_SZ * sz_expanded);
-    g_queue.enqueueWriteBuffer(input_buffer, CL_TRUE, 0, FLOAT_SZ * sz_expanded, array.data());
+    std::vector<T> result(input.n);
+    auto start = std::chrono::steady_clock::now();
+    scan_cpu<T, Op>(input.array, options.segments.empty() ? nullptr : flags.array, result.data(), input.n,
+                    options.exclusive);
+    log_time("CPU", start);
 
-    Buffer blocks_buffer(g_context, CL_MEM_READ_WRITE, FLOAT_SZ * block_num);
-    Buffer blocks_sum_buffer(g_context, CL_MEM_READ_ONLY, FLOAT_SZ * block_num);
-    Buffer output_buffer(g_context, CL_MEM_READ_WRITE, FLOAT_SZ * sz_expanded);
+    write_output(result.data(), input.n, input.binary != nullptr);
+}
 
-    EnqueueArgs args(g_queue, NDRange(sz_expanded), NDRange(BLOCK_SZ));
-    auto local_space = Local(local_memory_sz);
-    auto event = (*kf_sum_blocks)(args, input_buffer, blocks_buffer, local_space, local_space, output_buffer);
-    event.wait();
+#ifdef HAVE_OPENCL
+template<class T, class Op>
+void run_opencl_scan(scan::scanner &scanner, const Context &context, const CommandQueue &queue,
+                     const scan_options &options) {
+    input_data<T> input;
+    read_input(INPUT, input, options.length);
+    if (input.n > scan::scanner::MAX_SIZE) {
+        logger.error("Array is too long for the OpenCL scan, use -b cpu");
+        std::cerr << "Array is too long for the OpenCL scan, use -b cpu" << std::endl;
+        exit(1);
+    }
 
-    if (block_num != 1) {
-        auto blocks_sums = copy_from_buffer(blocks_buffer, block_num);
-        floats pr_sums_blocks = prefixsum(blocks_sums);
-        g_queue.enqueueWriteBuffer(blocks_sum_buffer, CL_TRUE, 0, FLOAT_SZ * block_num, pr_sums_blocks.data());
-        event = (*kf_sum_array)(args, blocks_sum_buffer, output_buffer);
-        event.wait();
+    // buffers are never empty, even for an empty array
+    auto bytes = sizeof(T) * std::max(input.n, 1ul);
+    Buffer input_buffer(context, CL_MEM_READ_ONLY, bytes);
+    Buffer output_buffer(context, CL_MEM_READ_WRITE, bytes);
+    if (input.n != 0) {
+        queue.enqueueWriteBuffer(input_buffer, CL_FALSE, 0, sizeof(T) * input.n, input.array);
     }
-    return copy_from_buffer(output_buffer, array.size());
+
+    input_data<uint8_t> flags;
+    Buffer flags_buffer;
+    if (!options.segments.empty()) {
+        read_flags(options.segments, flags, options.length, input.n);
+        flags_buffer = Buffer(context, CL_MEM_READ_ONLY, std::max(input.n, 1ul));
+        if (input.n != 0) {
+            queue.enqueueWriteBuffer(flags_buffer, CL_FALSE, 0, input.n, flags.array);
+        }
+    }
+    queue.finish();
+
+    auto start = std::chrono::steady_clock::now();
+    if (!options.segments.empty()) {
+        if (options.exclusive) {
+            scanner.segmented_exclusive_scan<T, Op>(input_buffer, flags_buffer, output_buffer, input.n);
+        } else {
+            scanner.segmented_inclusive_scan<T, Op>(input_buffer, flags_buffer, output_buffer, input.n);
+        }
+    } else if (options.exclusive) {
+        scanner.exclusive_scan<T, Op>(input_buffer, output_buffer, input.n);
+    } else {
+        scanner.inclusive_scan<T, Op>(input_buffer, output_buffer, input.n, options.algorithm);
+    }
+    queue.finish();
+    log_time("OpenCL", start);
+
+    // results are written straight from the mapped device buffer
+    auto result = (const T *) queue.enqueueMapBuffer(output_buffer, CL_TRUE, CL_MAP_READ, 0, bytes);
+    write_output(result, input.n, input.binary != nullptr);
+    queue.enqueueUnmapMemObject(output_buffer, (void *) result);
+    queue.finish();
 }
 
-int main() {
-    auto devices = get_decices();
-    g_context = Context(devices);
+template<class T, class Op>
+void run_opencl_scan(const scan_options &options, const std::vector<Device> &devices) {
+    Context context(devices);
 
     auto device = devices.back();
     logger.info("Using device " + device.getInfo<CL_DEVICE_NAME>());
 
-    auto sources = get_sources();
+    CommandQueue queue(context, device);
+    scan::scanner scanner(context, device, queue, prefixsum_kernel_source, [](const std::string &build_log) {
+        logger.info(build_log);
+    });
+    scanner.set_max_block_size(options.block);
+    run_opencl_scan<T, Op>(scanner, context, queue, options);
+}
+#endif
 
-    Program program(g_context, sources);
-    auto ret = program.build({device});
-    logger.info("PROGRAM BUILD LOG:\n" + program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device));
-    logger.error(ret != CL_SUCCESS, "Could not build *.cl sources.");
-    assert(ret == CL_SUCCESS);
+template<class T, class Op>
+void run_scan(const scan_options &options) {
+#ifdef HAVE_OPENCL
+    if (options.backend != backend_type::cpu) {
+        auto devices = get_decices();
+        if (!devices.empty()) {
+            run_opencl_scan<T, Op>(options, devices);
+            return;
+        }
+        if (options.backend == backend_type::opencl) {
+            std::cerr << "No OpenCL devices found" << std::endl;
+            exit(1);
+        }
+        logger.info("Falling back to the CPU backend");
+    }
+#else
+    if (options.backend == backend_type::opencl) {
+        logger.error("Built without OpenCL support");
+        std::cerr << "Built without OpenCL support" << std::endl;
+        exit(1);
+    }
+#endif
+    run_cpu_scan<T, Op>(options);
+}
 
-    g_queue = CommandQueue(g_context, device);
+template<class T>
+void run_scan(const scan_options &options) {
+    switch (options.op) {
+        case operator_type::sum:
+            run_scan<T, scan::plus>(options);
+            break;
+        case operator_type::max:
+            run_scan<T, scan::maximum>(options);
+            break;
+        case operator_type::min:
+            run_scan<T, scan::minimum>(options);
+            break;
+    }
+}
 
-    kf_sum_blocks = std::make_shared<kf_block_sum>(Kernel(program, "sum_blocks"));
-    kf_sum_array = std::make_shared<kf_array_sum>(Kernel(program, "sum_array"));
+int main(int argc, char **argv) {
+    scan_options options;
+    // parse_* throw std::invalid_argument for unknown values, std::stoul throws for malformed numbers
+    try {
+        for (int i = 1; i < argc; i += 2) {
+            std::string flag = argv[i];
+            if (flag == "-h" || flag == "--help") {
+                usage(argv[0]);
+                exit(0);
+            } else if (flag == "-b" && i + 1 < argc) {
+                options.backend = parse_backend_type(argv[i + 1]);
+            } else if (flag == "-m" && i + 1 < argc) {
+                options.algorithm = parse_algorithm(argv[i + 1]);
+            } else if (flag == "-n" && i + 1 < argc) {
+                options.length = std::stoul(argv[i + 1]);
+            } else if (flag == "-t" && i + 1 < argc) {
+                options.type = parse_value_type(argv[i + 1]);
+            } else if (flag == "-o" && i + 1 < argc) {
+                options.op = parse_operator_type(argv[i + 1]);
+            } else if (flag == "-x" && i + 1 < argc && std::string(argv[i + 1]) == "inclusive") {
+                options.exclusive = false;
+            } else if (flag == "-x" && i + 1 < argc && std::string(argv[i + 1]) == "exclusive") {
+                options.exclusive = true;
+            } else if (flag == "-s" && i + 1 < argc) {
+                options.segments = argv[i + 1];
+            } else if (flag == "-B" && i + 1 < argc) {
+                options.block = std::stoul(argv[i + 1]);
+            } else {
+                usage(argv[0]);
+                exit(1);
+            }
+        }
+    } catch (const std::logic_error &e) {
+        std::cerr << e.what() << std::endl;
+        usage(argv[0]);
+        exit(1);
+    }
+    if (options.exclusive && options.algorithm == scan::algorithm::tree) {
+        std::cerr << "Tree scan is inclusive only" << std::endl;
+        usage(argv[0]);
+        exit(1);
+    }
 
-    auto array = read_input();
-    auto result = prefixsum(array);
-    write_output(result);
+    // broken binary files and failed file operations throw in every build
+    try {
+        switch (options.type) {
+            case value_type::float32:
+                run_scan<float>(options);
+                break;
+            case value_type::int32:
+                run_scan<int32_t>(options);
+                break;
+            case value_type::int64:
+                run_scan<int64_t>(options);
+                break;
+            case value_type::float64:
+                run_scan<double>(options);
+                break;
+        }
+    } catch (const binary_io::error &e) {
+        logger.error(e.what());
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,79 @@
+#ifndef AU_PARALLEL_COMPUTING_OPERATORS_H
+#define AU_PARALLEL_COMPUTING_OPERATORS_H
+
+#include <algorithm>
+#include <limits>
+
+/**
+ * Associative operators of the scans, shared by the OpenCL and the CPU backend.
+ * `name` is the SCAN_OP value of the kernels, `apply` and `identity` are the host side
+ * of the same operator.
+ */
+namespace scan {
+    struct plus {
+        static const char *name() { return "SCAN_ADD"; }
+
+        template<class T>
+        static T apply(T a, T b) { return a + b; }
+
+        template<class T>
+        static T identity() { return T(0); }
+    };
+
+    struct maximum {
+        static const char *name() { return "SCAN_MAX"; }
+
+        template<class T>
+        static T apply(T a, T b) { return std::max(a, b); }
+
+        template<class T>
+        static T identity() {
+            return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity()
+                                                        : std::numeric_limits<T>::lowest();
+        }
+    };
+
+    struct minimum {
+        static const char *name() { return "SCAN_MIN"; }
+
+        template<class T>
+        static T apply(T a, T b) { return std::min(a, b); }
+
+        template<class T>
+        static T identity() {
+            return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity()
+                                                        : std::numeric_limits<T>::max();
+        }
+    };
+
+    // predicates of the primitives (primitives.h): `name` is the PREDICATE value of their kernels,
+    // `value` is the operand of the comparisons
+    struct nonzero {
+        static const char *name() { return "PRED_NONZERO"; }
+
+        template<class T>
+        static bool apply(T x, T) { return x != 0; }
+    };
+
+    struct less {
+        static const char *name() { return "PRED_LESS"; }
+
+        template<class T>
+        static bool apply(T x, T value) { return x < value; }
+    };
+
+    struct greater_equal {
+        static const char *name() { return "PRED_GREATER_EQUAL"; }
+
+        template<class T>
+        static bool apply(T x, T value) { return x >= value; }
+    };
+
+    // tree: scan of blocks, scan of their totals, combine the totals back (inclusive, not segmented only);
+    // single_pass: decoupled look-back, reads and writes the array once
+    enum class algorithm {
+        tree, single_pass
+    };
+}
+
+#endif //AU_PARALLEL_COMPUTING_OPERATORS_H
@@ -1,47 +1,312 @@
-void kernel sum_array(global float const *blocks_sums,
-                      global float *output) {
-    int block_i = get_group_id(0) - 1;
-    if (block_i >= 0) {
-        output[get_global_id(0)] += blocks_sums[block_i];
-    }
+// Scan kernels are generated by build options:
+//   SCAN_T                   element type (float, int, long, double)
+//   SCAN_T_MIN, SCAN_T_MAX   smallest and largest values of SCAN_T, identities of max and min
+//   SCAN_OP                  SCAN_ADD, SCAN_MAX or SCAN_MIN
+//   SEGMENTED                scan restarts at every element with a non-zero flag
+//   ITEMS_PER_THREAD
+// Without options the kernels are an inclusive float sum.
+// Lengths are uint, but element indices are computed in ulong: the last block of an array close to
+// 2^32 elements reaches past it, and size_t is 32-bit on some devices.
+
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+#ifndef SCAN_T
+#define SCAN_T float
+#define SCAN_T_MIN (-INFINITY)
+#define SCAN_T_MAX INFINITY
+#endif
+
+#define SCAN_ADD 0
+#define SCAN_MAX 1
+#define SCAN_MIN 2
+
+#ifndef SCAN_OP
+#define SCAN_OP SCAN_ADD
+#endif
+
+#if SCAN_OP == SCAN_ADD
+#define OP(a, b) ((a) + (b))
+#define IDENTITY ((SCAN_T) 0)
+#elif SCAN_OP == SCAN_MAX
+#define OP(a, b) max((SCAN_T) (a), (SCAN_T) (b))
+#define IDENTITY SCAN_T_MIN
+#elif SCAN_OP == SCAN_MIN
+#define OP(a, b) min((SCAN_T) (a), (SCAN_T) (b))
+#define IDENTITY SCAN_T_MAX
+#endif
+
+#ifndef ITEMS_PER_THREAD
+#define ITEMS_PER_THREAD 8
+#endif
+
+// Every 32nd element of a local block is skipped, so that work-items walking their
+// ITEMS_PER_THREAD consecutive elements do not hit the same local memory bank.
+#define PAD(i) ((i) + ((i) >> 5))
+
+// Element of the scan. A segmented scan is an ordinary scan of (flag, value) pairs with
+// an operator that drops everything on the left of a set flag, so the rest of the code
+// only sees `item`, `combine` and `identity`.
+#ifdef SEGMENTED
+typedef struct {
+    SCAN_T value;
+    uint flag;
+} item;
+
+item combine(item a, item b) {
+    item result;
+    result.value = b.flag ? b.value : OP(a.value, b.value);
+    result.flag = a.flag | b.flag;
+    return result;
+}
+
+item identity() {
+    item result;
+    result.value = IDENTITY;
+    result.flag = 0;
+    return result;
 }
 
-inline void swap(local float **a, local float **b) {
-    local float * tmp = *a;
-    *a = *b;
-    *b = tmp;
+item make_item(SCAN_T value, uint flag) {
+    item result;
+    result.value = value;
+    result.flag = flag;
+    return result;
 }
 
-// Hills-Steele scan
-void kernel sum_blocks(global float const *array,
-                       global float *block_sum,
-                       local float *block_sums,
-                       local float *aux,
-                       global float *output) {
+#define VALUE(x) ((x).value)
+#else
+typedef SCAN_T item;
 
-    int array_i = get_global_id(0);
+#define combine(a, b) OP(a, b)
+#define identity() IDENTITY
+#define make_item(value, flag) (value)
+#define VALUE(x) (x)
+#endif
+
+// Work-efficient (Blelloch) exclusive scan of `sums`, one element per work-item,
+// work-group size must be a power of two. Returns the total of all elements.
+item scan_work_group(local item *sums) {
     int index = get_local_id(0);
-    int block_sz = get_local_size(0);
-    int block_i = get_group_id(0);
+    int size = get_local_size(0);
+
+    int offset = 1;
+    for (int d = size >> 1; d > 0; d >>= 1) {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (index < d) {
+            int ai = offset * (2 * index + 1) - 1;
+            int bi = offset * (2 * index + 2) - 1;
+            sums[bi] = combine(sums[ai], sums[bi]);
+        }
+        offset <<= 1;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+    item total = sums[size - 1];
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (index == 0) {
+        sums[size - 1] = identity();
+    }
+
+    for (int d = 1; d < size; d <<= 1) {
+        offset >>= 1;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (index < d) {
+            int ai = offset * (2 * index + 1) - 1;
+            int bi = offset * (2 * index + 2) - 1;
+            item left = sums[ai];
+            sums[ai] = sums[bi];
+            sums[bi] = combine(sums[bi], left);
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    return total;
+}
+
+// Inclusive scan of the block of get_local_size(0) * ITEMS_PER_THREAD elements starting at
+// `block_start` into local `block`, elements past n are identities. Every work-item scans its
+// ITEMS_PER_THREAD consecutive elements sequentially, the per-item totals are combined with
+// scan_work_group. Returns the total of the block.
+item scan_block(global SCAN_T const *input,
+                global uchar const *flags,
+                uint n,
+                ulong block_start,
+                local item *block,
+                local item *thread_sums) {
+    int index = get_local_id(0);
+    int threads = get_local_size(0);
+    int block_sz = threads * ITEMS_PER_THREAD;
+
+    for (int i = index; i < block_sz; i += threads) {
+        ulong array_i = block_start + i;
+        block[PAD(i)] = array_i < n ? make_item(input[array_i], flags[array_i] != 0) : identity();
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int first = index * ITEMS_PER_THREAD;
+    item sum = identity();
+    for (int i = first; i < first + ITEMS_PER_THREAD; i++) {
+        sum = combine(sum, block[PAD(i)]);
+        block[PAD(i)] = sum;
+    }
+    thread_sums[index] = sum;
+
+    item total = scan_work_group(thread_sums);
+
+    item offset = thread_sums[index];
+    for (int i = first; i < first + ITEMS_PER_THREAD; i++) {
+        block[PAD(i)] = combine(offset, block[PAD(i)]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-    block_sums[index] = array[array_i];
+    return total;
+}
 
-    for(int shift = 1; shift < block_sz; shift += shift) {
+// Writes the scanned local `block` with `offset` (everything before the block) combined in.
+// An exclusive scan takes the element on the left, segment starts get the identity.
+void store_block(global SCAN_T *output,
+                 global uchar const *flags,
+                 uint n,
+                 ulong block_start,
+                 local item const *block,
+                 item offset,
+                 uint exclusive) {
+    int threads = get_local_size(0);
+    int block_sz = threads * ITEMS_PER_THREAD;
 
-        if (index < shift) {
-            aux[index] = block_sums[index];
+    for (int i = get_local_id(0); i < block_sz; i += threads) {
+        ulong array_i = block_start + i;
+        if (array_i >= n) {
+            continue;
+        }
+        if (!exclusive) {
+            output[array_i] = VALUE(combine(offset, block[PAD(i)]));
+#ifdef SEGMENTED
+        } else if (flags[array_i] != 0) {
+            output[array_i] = IDENTITY;
+#endif
         } else {
-            aux[index] = block_sums[index] + block_sums[index - shift];
+            output[array_i] = VALUE(i == 0 ? offset : combine(offset, block[PAD(i - 1)]));
         }
+    }
+}
 
-        barrier(CLK_LOCAL_MEM_FENCE);
+#ifndef SEGMENTED
+// Inclusive scan of every block separately, block totals go to `block_sums`.
+// `block` holds PAD(block size) items, `thread_sums` one item per work-item.
+void kernel scan_blocks(global SCAN_T const *input,
+                        global SCAN_T *output,
+                        global SCAN_T *block_sums,
+                        uint n,
+                        local item *block,
+                        local item *thread_sums) {
+    ulong block_start = (ulong) get_group_id(0) * get_local_size(0) * ITEMS_PER_THREAD;
+
+    item total = scan_block(input, 0, n, block_start, block, thread_sums);
+    store_block(output, 0, n, block_start, block, identity(), 0);
+
+    if (get_local_id(0) == 0) {
+        block_sums[get_group_id(0)] = total;
+    }
+}
 
-        swap(&block_sums, &aux);
+// Combines inclusive scan of the preceding blocks' totals into every block but the first one.
+void kernel add_block_sums(global SCAN_T *output,
+                           global SCAN_T const *scanned_block_sums,
+                           uint n) {
+    int block_i = get_group_id(0);
+    if (block_i == 0) {
+        return;
     }
 
-    output[array_i] = block_sums[index];
+    int threads = get_local_size(0);
+    int block_sz = threads * ITEMS_PER_THREAD;
+    ulong block_start = (ulong) block_i * block_sz;
+    SCAN_T offset = scanned_block_sums[block_i - 1];
 
-    if (index + 1 == block_sz) {
-        block_sum[block_i] = output[array_i];
+    for (int i = get_local_id(0); i < block_sz; i += threads) {
+        ulong array_i = block_start + i;
+        if (array_i < n) {
+            output[array_i] = OP(offset, output[array_i]);
+        }
     }
-}
\ No newline at end of file
+}
+#endif
+
+// States of a tile in the single-pass scan.
+#define TILE_INVALID 0u
+#define TILE_AGGREGATE 1u
+#define TILE_PREFIX 2u
+
+// Single-pass scan with decoupled look-back: every array element is read and written once.
+// Tiles are taken in the order work-groups start (`tile_counter`), so all predecessors of a tile
+// are already running and waiting on them can not deadlock. A tile publishes its own total
+// (TILE_AGGREGATE) right after the local scan, then walks back over the predecessors combining
+// their totals until it meets one with a known inclusive prefix (TILE_PREFIX), and publishes
+// its own inclusive prefix. A tile with a segment start has its total as the prefix right away.
+// `tile_counter` and `tile_flags` (one per work-group) must be zeroed, `flags` is only read
+// by segmented scans.
+void kernel scan_single_pass(global SCAN_T const *input,
+                             global uchar const *flags,
+                             global SCAN_T *output,
+                             global volatile uint *tile_counter,
+                             global volatile uint *tile_flags,
+                             global volatile SCAN_T *tile_aggregates,
+                             global volatile SCAN_T *tile_prefixes,
+                             uint n,
+                             uint exclusive,
+                             local item *block,
+                             local item *thread_sums) {
+    local uint tile;
+    local SCAN_T tile_offset;
+
+    if (get_local_id(0) == 0) {
+        tile = atomic_inc(tile_counter);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    ulong block_start = (ulong) tile * get_local_size(0) * ITEMS_PER_THREAD;
+    item total = scan_block(input, flags, n, block_start, block, thread_sums);
+
+    if (get_local_id(0) == 0) {
+#ifdef SEGMENTED
+        bool known_prefix = tile == 0 || total.flag;
+#else
+        bool known_prefix = tile == 0;
+#endif
+        if (known_prefix) {
+            tile_prefixes[tile] = VALUE(total);
+            write_mem_fence(CLK_GLOBAL_MEM_FENCE);
+            atomic_xchg(&tile_flags[tile], TILE_PREFIX);
+        } else {
+            tile_aggregates[tile] = VALUE(total);
+            write_mem_fence(CLK_GLOBAL_MEM_FENCE);
+            atomic_xchg(&tile_flags[tile], TILE_AGGREGATE);
+        }
+
+        // totals met on the way back have no segment starts, so they combine with OP
+        SCAN_T prefix = IDENTITY;
+        for (uint j = tile; j-- > 0;) {
+            uint flag;
+            while ((flag = atomic_or(&tile_flags[j], 0u)) == TILE_INVALID) {}
+            read_mem_fence(CLK_GLOBAL_MEM_FENCE);
+            if (flag == TILE_PREFIX) {
+                prefix = OP(tile_prefixes[j], prefix);
+                break;
+            }
+            prefix = OP(tile_aggregates[j], prefix);
+        }
+
+        if (!known_prefix) {
+            tile_prefixes[tile] = OP(prefix, VALUE(total));
+            write_mem_fence(CLK_GLOBAL_MEM_FENCE);
+            atomic_xchg(&tile_flags[tile], TILE_PREFIX);
+        }
+        tile_offset = prefix;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    store_block(output, flags, n, block_start, block, make_item(tile_offset, 0), exclusive);
+}
@@ -0,0 +1,319 @@
+#ifndef AU_PARALLEL_COMPUTING_PRIMITIVES_H
+#define AU_PARALLEL_COMPUTING_PRIMITIVES_H
+
+#ifdef __APPLE__
+#include <OpenCL/cl.hpp>
+#else
+
+#include <CL/cl.hpp>
+
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "operators.h"
+#include "program_cache.h"
+#include "scan.h"
+
+/**
+ * Parallel primitives of OpenCL buffers built on the scans of scan::scanner.
+ *
+ * Every primitive only enqueues commands to the in-order queue: inputs, outputs and counts stay
+ * in device buffers, so primitives chain with each other and with other kernels without a host
+ * round trip. Counts are single cl_uint buffers, read them when the host needs them.
+ *
+ *     scan::primitives primitives(context, device, queue, prefixsum_kernel_source, primitives_kernel_source);
+ *     primitives.compact<cl_float, scan::greater_equal>(input, output, count, n, 0.5f);
+ *     primitives.sort<cl_uint>(keys, n);
+ *
+ * Kernels of primitives_kernel.cl are built for every (type, predicate) pair like the scans are,
+ * binaries are kept on disk by program_cache.h. Scratch buffers are kept between calls and only
+ * grow when a call takes more elements than the ones before.
+ */
+namespace scan {
+    class primitives {
+    public:
+        primitives(const cl::Context &context, const cl::Device &device, const cl::CommandQueue &queue,
+                   const std::string &scan_source, const std::string &source,
+                   scanner::build_logger log = scanner::build_logger())
+                : context(context), device(device), queue(queue), source(source), log(log),
+                  scans(context, device, queue, scan_source, log) {}
+
+        // the scans the primitives run on
+        scanner &get_scanner() { return scans; }
+
+        /**
+         * Stream compaction: elements of `input` that satisfy Pred(x, value) are written to the start
+         * of `output` in their order, their number to `count`.
+         */
+        template<class T, class Pred = nonzero>
+        void compact(const cl::Buffer &input, cl::Buffer &output, cl::Buffer &count, unsigned long n,
+                     T value = T()) {
+            split<T, Pred>(input, output, count, n, value, false);
+        }
+
+        /**
+         * Stable partition: elements of `input` that satisfy Pred(x, value) go first, then the rest,
+         * both in their order. The number of the first ones goes to `count`.
+         */
+        template<class T, class Pred = nonzero>
+        void partition(const cl::Buffer &input, cl::Buffer &output, cl::Buffer &count, unsigned long n,
+                       T value = T()) {
+            split<T, Pred>(input, output, count, n, value, true);
+        }
+
+        /**
+         * Ascending LSD radix sort of cl_uint or cl_float keys in place, 8 passes of 4-bit digits.
+         * A pass counts the digits of every tile of keys, scans the counts once and scatters the tiles
+         * stably by them, see radix_count and radix_scatter. Floats are sorted through their bits mapped to
+         * unsigned keys of the same order, -0 goes before +0, NaNs past the infinity of their sign.
+         */
+        template<class T>
+        void sort(cl::Buffer &keys, unsigned long n) {
+            static_assert(std::is_same<T, cl_uint>::value || std::is_same<T, cl_float>::value,
+                          "Only cl_uint and cl_float keys are sorted");
+            assert(n <= scanner::MAX_SIZE);
+            if (n == 0) {
+                return;
+            }
+            auto &program = get_program<cl_uint, nonzero>();
+            const unsigned long threads = program.sort_threads;
+            const unsigned long tiles = (n + threads * SORT_ITEMS - 1) / (threads * SORT_ITEMS);
+            cl::Buffer &temp = grow(sort_keys, sizeof(cl_uint) * n);
+            cl::Buffer &tile_counts = grow(sort_counts, sizeof(cl_uint) * RADIX * tiles);
+            cl::Buffer &tile_offsets = grow(sort_offsets, sizeof(cl_uint) * RADIX * tiles);
+
+            const bool floats = std::is_same<T, cl_float>::value;
+            if (floats) {
+                program.float_to_key.setArg(0, keys);
+                program.float_to_key.setArg(1, (cl_uint) n);
+                enqueue(program.float_to_key, n);
+            }
+
+            // an even number of passes, so the keys end up in `keys`
+            cl::Buffer *from = &keys;
+            cl::Buffer *to = &temp;
+            for (cl_uint shift = 0; shift < 32; shift += RADIX_BITS) {
+                program.radix_count.setArg(0, *from);
+                program.radix_count.setArg(1, tile_counts);
+                program.radix_count.setArg(2, (cl_uint) n);
+                program.radix_count.setArg(3, shift);
+                program.radix_count.setArg(4, (cl_uint) tiles);
+                program.radix_count.setArg(5, sizeof(cl_uint) * RADIX, nullptr);
+                queue.enqueueNDRangeKernel(program.radix_count, cl::NullRange, cl::NDRange(tiles * threads),
+                                           cl::NDRange(threads));
+
+                scans.exclusive_scan<cl_uint>(tile_counts, tile_offsets, RADIX * tiles);
+
+                program.radix_scatter.setArg(0, *from);
+                program.radix_scatter.setArg(1, *to);
+                program.radix_scatter.setArg(2, tile_offsets);
+                program.radix_scatter.setArg(3, (cl_uint) n);
+                program.radix_scatter.setArg(4, shift);
+                program.radix_scatter.setArg(5, (cl_uint) tiles);
+                program.radix_scatter.setArg(6, sizeof(cl_uint) * RADIX * threads, nullptr);
+                queue.enqueueNDRangeKernel(program.radix_scatter, cl::NullRange, cl::NDRange(tiles * threads),
+                                           cl::NDRange(threads));
+                std::swap(from, to);
+            }
+
+            if (floats) {
+                program.key_to_float.setArg(0, keys);
+                program.key_to_float.setArg(1, (cl_uint) n);
+                enqueue(program.key_to_float, n);
+            }
+        }
+
+        /**
+         * Counts of `bins` equal bins over [lo, hi) into `counts` (`bins` cl_uint), values outside
+         * of the range are not counted. Integer ranges must be narrower than 2^32.
+         * Work-groups count in local memory when the bins fit there next to what the kernel takes itself,
+         * otherwise every value is counted with a global atomic.
+         */
+        template<class T>
+        void histogram(const cl::Buffer &input, cl::Buffer &counts, unsigned long n, cl_uint bins, T lo, T hi) {
+            assert(n <= scanner::MAX_SIZE && bins > 0 && lo < hi);
+            queue.enqueueFillBuffer(counts, (cl_uint) 0, 0, sizeof(cl_uint) * bins);
+            if (n == 0) {
+                return;
+            }
+
+            auto &program = get_program<T, nonzero>();
+            const bool local_counts = program.histogram_local_sz + sizeof(cl_uint) * bins <=
+                                      device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+            cl::Kernel &kernel = local_counts ? program.histogram : program.histogram_global;
+            kernel.setArg(0, input);
+            kernel.setArg(1, counts);
+            kernel.setArg(2, (cl_uint) n);
+            kernel.setArg(3, bins);
+            kernel.setArg(4, lo);
+            kernel.setArg(5, hi);
+            if (local_counts) {
+                kernel.setArg(6, sizeof(cl_uint) * bins, nullptr);
+            }
+
+            // a few work-groups per compute unit walk the input with a stride, so that
+            // the counts of every work-group are added to `counts` once
+            unsigned long threads = HISTOGRAM_THREADS;
+            threads = std::min(threads, (unsigned long) kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+            unsigned long groups = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * HISTOGRAM_GROUPS_PER_UNIT;
+            groups = std::min(groups, (n + threads - 1) / threads);
+            queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(groups * threads), cl::NDRange(threads));
+        }
+
+    private:
+        static const unsigned long HISTOGRAM_THREADS = 256;
+        static const unsigned long HISTOGRAM_GROUPS_PER_UNIT = 8;
+        // bits of a radix sort digit and digits of a pass, as in primitives_kernel.cl
+        static const unsigned long RADIX_BITS = 4;
+        static const unsigned long RADIX = 1 << RADIX_BITS;
+        // keys a work-item of the radix sort takes and the most work-items of a work-group
+        static const unsigned long SORT_ITEMS = 16;
+        static const unsigned long SORT_THREADS = 128;
+
+        struct primitives_program {
+            cl::Program program;
+            cl::Kernel flag_predicate;
+            cl::Kernel scatter_flagged;
+            cl::Kernel scatter_split;
+            cl::Kernel float_to_key;
+            cl::Kernel key_to_float;
+            cl::Kernel radix_count;
+            cl::Kernel radix_scatter;
+            cl::Kernel histogram;
+            cl::Kernel histogram_global;
+            // work-items of a radix sort work-group
+            unsigned long sort_threads;
+            // local memory the histogram kernel takes without its counts
+            unsigned long histogram_local_sz;
+        };
+
+        // a device buffer kept between calls, reallocated only to grow
+        struct scratch_buffer {
+            cl::Buffer buffer;
+            unsigned long bytes = 0;
+        };
+
+        template<class T, class Pred>
+        primitives_program &get_program() {
+            std::string options = std::string("-D KEY_T=") + type_traits<T>::name() +
+                                  (std::is_floating_point<T>::value ? " -D KEY_FLOAT" : "") +
+                                  " -D PREDICATE=" + Pred::name() +
+                                  " -D SORT_ITEMS=" + std::to_string(SORT_ITEMS);
+            auto found = programs.find(options);
+            if (found != programs.end()) {
+                return found->second;
+            }
+
+            primitives_program &result = programs[options];
+            // binaries of earlier runs are reused, see program_cache.h
+            cl_int ret;
+            result.program = cl::Program(program_cache::build_program(context(), device(), source, options, ret));
+            if (log) {
+                log("PROGRAM BUILD LOG (" + options + "):\n" +
+                    result.program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device));
+            }
+            assert(ret == CL_SUCCESS && "Could not build primitive kernels");
+
+            result.flag_predicate = cl::Kernel(result.program, "flag_predicate");
+            result.scatter_flagged = cl::Kernel(result.program, "scatter_flagged");
+            result.scatter_split = cl::Kernel(result.program, "scatter_split");
+            result.float_to_key = cl::Kernel(result.program, "float_to_key");
+            result.key_to_float = cl::Kernel(result.program, "key_to_float");
+            result.radix_count = cl::Kernel(result.program, "radix_count");
+            result.radix_scatter = cl::Kernel(result.program, "radix_scatter");
+            result.histogram = cl::Kernel(result.program, "histogram");
+            result.histogram_global = cl::Kernel(result.program, "histogram_global");
+            result.sort_threads = sort_work_group_size(result);
+            // queried before the local counts are set, so only what the kernel declares itself is counted
+            result.histogram_local_sz = result.histogram.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(device);
+            return result;
+        }
+
+        // the most work-items, up to SORT_THREADS, the device and both radix sort kernels allow with their offsets
+        // still fitting into local memory
+        unsigned long sort_work_group_size(const primitives_program &program) const {
+            unsigned long threads = SORT_THREADS;
+            threads = std::min(threads, (unsigned long) device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+            for (const cl::Kernel *kernel : {&program.radix_count, &program.radix_scatter}) {
+                auto kernel_threads = kernel->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+                threads = std::min(threads, (unsigned long) kernel_threads);
+            }
+            const unsigned long local_memory_sz = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+            while (threads > 1 && sizeof(cl_uint) * RADIX * threads > local_memory_sz) {
+                threads /= 2;
+            }
+            return threads;
+        }
+
+        cl::Buffer &grow(scratch_buffer &scratch, unsigned long bytes) {
+            if (scratch.bytes < bytes) {
+                // commands already enqueued keep the old buffer alive until they are done
+                scratch.buffer = cl::Buffer(context, CL_MEM_READ_WRITE, bytes);
+                scratch.bytes = bytes;
+            }
+            return scratch.buffer;
+        }
+
+        // one work-item per element, the work-group size is left to the driver
+        void enqueue(const cl::Kernel &kernel, unsigned long n) {
+            queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(n), cl::NullRange);
+        }
+
+        // flags of the predicate, their exclusive scan and the scatter by them
+        template<class T, class Pred>
+        void split(const cl::Buffer &input, cl::Buffer &output, cl::Buffer &count, unsigned long n, T value,
+                   bool keep_rest) {
+            assert(n <= scanner::MAX_SIZE);
+            if (n == 0) {
+                queue.enqueueFillBuffer(count, (cl_uint) 0, 0, sizeof(cl_uint));
+                return;
+            }
+            auto &program = get_program<T, Pred>();
+            cl::Buffer &flags = grow(split_flags, sizeof(cl_uint) * n);
+            cl::Buffer &positions = grow(split_positions, sizeof(cl_uint) * n);
+
+            program.flag_predicate.setArg(0, input);
+            program.flag_predicate.setArg(1, flags);
+            program.flag_predicate.setArg(2, (cl_uint) n);
+            program.flag_predicate.setArg(3, value);
+            enqueue(program.flag_predicate, n);
+
+            scans.exclusive_scan<cl_uint>(flags, positions, n);
+            scatter(keep_rest ? program.scatter_split : program.scatter_flagged, input, flags, positions, output,
+                    count, n);
+        }
+
+        void scatter(cl::Kernel &kernel, const cl::Buffer &input, const cl::Buffer &flags,
+                     const cl::Buffer &positions, cl::Buffer &output, cl::Buffer &count, unsigned long n) {
+            kernel.setArg(0, input);
+            kernel.setArg(1, flags);
+            kernel.setArg(2, positions);
+            kernel.setArg(3, output);
+            kernel.setArg(4, count);
+            kernel.setArg(5, (cl_uint) n);
+            enqueue(kernel, n);
+        }
+
+        cl::Context context;
+        cl::Device device;
+        cl::CommandQueue queue;
+        std::string source;
+        scanner::build_logger log;
+        scanner scans;
+        // keyed by build options
+        std::map<std::string, primitives_program> programs;
+        scratch_buffer sort_keys;
+        scratch_buffer sort_counts;
+        scratch_buffer sort_offsets;
+        scratch_buffer split_flags;
+        scratch_buffer split_positions;
+    };
+}
+
+#endif //AU_PARALLEL_COMPUTING_PRIMITIVES_H
@@ -0,0 +1,243 @@
+// Kernels of the scan-based primitives of primitives.h, generated by build options:
+//   KEY_T       element type (float, int, uint, long, double)
+//   KEY_FLOAT   defined if KEY_T is a floating point type
+//   PREDICATE   PRED_NONZERO, PRED_LESS or PRED_GREATER_EQUAL, `value` is the operand of the comparisons
+//   SORT_ITEMS  keys every work-item of the radix sort kernels takes
+// Positions of flagged elements are exclusive scans of the flags by scan::scanner, counts are written
+// to device buffers, so primitives chain without reading anything back.
+// Without options the kernels work on floats with the PRED_NONZERO predicate.
+
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+#ifndef KEY_T
+#define KEY_T float
+#define KEY_FLOAT
+#endif
+
+#define PRED_NONZERO 0
+#define PRED_LESS 1
+#define PRED_GREATER_EQUAL 2
+
+#ifndef PREDICATE
+#define PREDICATE PRED_NONZERO
+#endif
+
+#ifndef SORT_ITEMS
+#define SORT_ITEMS 16
+#endif
+
+// digits of a radix sort pass
+#define RADIX_BITS 4
+#define RADIX (1 << RADIX_BITS)
+
+#if PREDICATE == PRED_NONZERO
+#define TEST(x, value) ((x) != 0)
+#elif PREDICATE == PRED_LESS
+#define TEST(x, value) ((x) < (value))
+#elif PREDICATE == PRED_GREATER_EQUAL
+#define TEST(x, value) ((x) >= (value))
+#endif
+
+// flags[i] = 1 if input[i] satisfies the predicate
+void kernel flag_predicate(global KEY_T const *input,
+                           global uint *flags,
+                           uint n,
+                           KEY_T value) {
+    uint i = get_global_id(0);
+    if (i < n) {
+        flags[i] = TEST(input[i], value) ? 1 : 0;
+    }
+}
+
+// elements with a set flag: the exclusive scan of the flags at the last element plus its own flag
+uint flagged_count(global uint const *flags, global uint const *positions, uint n) {
+    return positions[n - 1] + flags[n - 1];
+}
+
+// Stream compaction: elements with a set flag go to their positions, their number goes to `count`.
+void kernel scatter_flagged(global KEY_T const *input,
+                            global uint const *flags,
+                            global uint const *positions,
+                            global KEY_T *output,
+                            global uint *count,
+                            uint n) {
+    uint i = get_global_id(0);
+    if (i >= n) {
+        return;
+    }
+    if (i == 0) {
+        *count = flagged_count(flags, positions, n);
+    }
+    if (flags[i]) {
+        output[positions[i]] = input[i];
+    }
+}
+
+// Stable split: elements with a set flag go first, then the rest, both in their order.
+// The number of flagged elements goes to `count`.
+void kernel scatter_split(global KEY_T const *input,
+                          global uint const *flags,
+                          global uint const *positions,
+                          global KEY_T *output,
+                          global uint *count,
+                          uint n) {
+    uint i = get_global_id(0);
+    if (i >= n) {
+        return;
+    }
+    uint flagged = flagged_count(flags, positions, n);
+    if (i == 0) {
+        *count = flagged;
+    }
+    output[flags[i] ? positions[i] : flagged + i - positions[i]] = input[i];
+}
+
+// One pass of LSD radix sort takes the digit of RADIX_BITS bits at `shift` of every key.
+// A work-group sorts a tile of get_local_size(0) * SORT_ITEMS keys, a work-item a run of SORT_ITEMS of them.
+// radix_count writes how many keys of every digit a tile has, digit-major: tile_counts[digit * tiles + tile].
+// Their exclusive scan is where the keys of a digit of a tile start in the output, radix_scatter moves them
+// there in their order, so every pass is stable.
+
+// first key of the run of the work-item
+ulong run_start() {
+    return ((ulong) get_group_id(0) * get_local_size(0) + get_local_id(0)) * SORT_ITEMS;
+}
+
+// `counts` holds RADIX uints
+void kernel radix_count(global uint const *keys,
+                        global uint *tile_counts,
+                        uint n,
+                        uint shift,
+                        uint tiles,
+                        local uint *counts) {
+    for (uint d = get_local_id(0); d < RADIX; d += get_local_size(0)) {
+        counts[d] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    ulong start = run_start();
+    for (uint k = 0; k < SORT_ITEMS && start + k < n; k++) {
+        atomic_inc(&counts[(keys[start + k] >> shift) & (RADIX - 1)]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (uint d = get_local_id(0); d < RADIX; d += get_local_size(0)) {
+        tile_counts[(ulong) d * tiles + get_group_id(0)] = counts[d];
+    }
+}
+
+// `tile_offsets` are the scanned tile_counts, `run_offsets` holds RADIX * get_local_size(0) uints
+void kernel radix_scatter(global uint const *keys,
+                          global uint *output,
+                          global uint const *tile_offsets,
+                          uint n,
+                          uint shift,
+                          uint tiles,
+                          local uint *run_offsets) {
+    const uint lid = get_local_id(0);
+    const uint threads = get_local_size(0);
+    ulong start = run_start();
+
+    uint offsets[RADIX];
+    for (uint d = 0; d < RADIX; d++) {
+        offsets[d] = 0;
+    }
+    for (uint k = 0; k < SORT_ITEMS && start + k < n; k++) {
+        offsets[(keys[start + k] >> shift) & (RADIX - 1)]++;
+    }
+    for (uint d = 0; d < RADIX; d++) {
+        run_offsets[d * threads + lid] = offsets[d];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // runs of a digit follow each other in the order of the work-items, from where the tile's keys start
+    for (uint d = lid; d < RADIX; d += threads) {
+        uint offset = tile_offsets[(ulong) d * tiles + get_group_id(0)];
+        for (uint t = 0; t < threads; t++) {
+            uint count = run_offsets[d * threads + t];
+            run_offsets[d * threads + t] = offset;
+            offset += count;
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (uint d = 0; d < RADIX; d++) {
+        offsets[d] = run_offsets[d * threads + lid];
+    }
+    for (uint k = 0; k < SORT_ITEMS && start + k < n; k++) {
+        uint key = keys[start + k];
+        output[offsets[(key >> shift) & (RADIX - 1)]++] = key;
+    }
+}
+
+// Bits of floats as unsigned keys in the order of the floats: negative ones are inverted,
+// the sign bit is set in positive ones. NaNs end up past the infinity of their sign.
+void kernel float_to_key(global uint *data, uint n) {
+    uint i = get_global_id(0);
+    if (i < n) {
+        uint bits = data[i];
+        data[i] = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+    }
+}
+
+// Inverse of float_to_key.
+void kernel key_to_float(global uint *data, uint n) {
+    uint i = get_global_id(0);
+    if (i < n) {
+        uint key = data[i];
+        data[i] = (key & 0x80000000u) ? key & 0x7fffffffu : ~key;
+    }
+}
+
+#ifdef KEY_FLOAT
+#define BIN(x, lo, hi, bins) min((uint) (((x) - (lo)) / ((hi) - (lo)) * (bins)), (bins) - 1)
+#else
+#define BIN(x, lo, hi, bins) ((uint) ((ulong) ((long) (x) - (long) (lo)) * (bins) / (ulong) ((long) (hi) - (long) (lo))))
+#endif
+
+// Counts of `bins` equal bins over [lo, hi), values outside of it are not counted. Every work-group
+// counts a strided part of the input in local memory, then adds its counts to `counts` (zeroed before).
+// `local_counts` holds `bins` uints. The stride is 64-bit, so that it does not wrap for n near 2^32.
+void kernel histogram(global KEY_T const *input,
+                      global uint *counts,
+                      uint n,
+                      uint bins,
+                      KEY_T lo,
+                      KEY_T hi,
+                      local uint *local_counts) {
+    for (uint b = get_local_id(0); b < bins; b += get_local_size(0)) {
+        local_counts[b] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (ulong i = get_global_id(0); i < n; i += get_global_size(0)) {
+        KEY_T x = input[i];
+        if (x >= lo && x < hi) {
+            atomic_inc(&local_counts[BIN(x, lo, hi, bins)]);
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (uint b = get_local_id(0); b < bins; b += get_local_size(0)) {
+        if (local_counts[b] != 0) {
+            atomic_add(&counts[b], local_counts[b]);
+        }
+    }
+}
+
+// histogram for bins that do not fit into local memory, every value is counted in `counts` directly
+void kernel histogram_global(global KEY_T const *input,
+                             global uint *counts,
+                             uint n,
+                             uint bins,
+                             KEY_T lo,
+                             KEY_T hi) {
+    for (ulong i = get_global_id(0); i < n; i += get_global_size(0)) {
+        KEY_T x = input[i];
+        if (x >= lo && x < hi) {
+            atomic_inc(&counts[BIN(x, lo, hi, bins)]);
+        }
+    }
+}
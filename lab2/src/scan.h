@@ -0,0 +1,296 @@
+#ifndef AU_PARALLEL_COMPUTING_SCAN_H
+#define AU_PARALLEL_COMPUTING_SCAN_H
+
+#ifdef __APPLE__
+#include <OpenCL/cl.hpp>
+#else
+
+#include <CL/cl.hpp>
+
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "operators.h"
+#include "program_cache.h"
+
+/**
+ * Scans of OpenCL buffers, templated on the element type and the operator.
+ *
+ * Kernels of prefixsum_kernel.cl are generated from build options for every
+ * (type, operator, segmented) triple, compiled programs are kept by the scanner,
+ * so switching between scans does not recompile anything, and their binaries are kept
+ * on disk by program_cache.h, so the next run does not compile them either.
+ *
+ *     scan::scanner scanner(context, device, queue, source);
+ *     scanner.inclusive_scan<cl_int, scan::maximum>(input, output, n);
+ *     scanner.segmented_exclusive_scan<double>(input, flags, output, n);
+ *
+ * Flags of segmented scans are one byte per element, a non-zero flag starts a new segment.
+ */
+namespace scan {
+    // OpenCL C name of the type and its smallest and largest values
+    template<class T>
+    struct type_traits;
+
+    template<>
+    struct type_traits<cl_int> {
+        static const char *name() { return "int"; }
+        static const char *min() { return "INT_MIN"; }
+        static const char *max() { return "INT_MAX"; }
+    };
+
+    template<>
+    struct type_traits<cl_uint> {
+        static const char *name() { return "uint"; }
+        static const char *min() { return "0"; }
+        static const char *max() { return "UINT_MAX"; }
+    };
+
+    template<>
+    struct type_traits<cl_long> {
+        static const char *name() { return "long"; }
+        static const char *min() { return "LONG_MIN"; }
+        static const char *max() { return "LONG_MAX"; }
+    };
+
+    template<>
+    struct type_traits<cl_float> {
+        static const char *name() { return "float"; }
+        static const char *min() { return "(-INFINITY)"; }
+        static const char *max() { return "INFINITY"; }
+    };
+
+    template<>
+    struct type_traits<cl_double> {
+        static const char *name() { return "double"; }
+        static const char *min() { return "(-INFINITY)"; }
+        static const char *max() { return "INFINITY"; }
+    };
+
+    class scanner {
+    public:
+        // elements every work-item scans sequentially
+        static const int ITEMS_PER_THREAD = 8;
+        // lengths are passed to the kernels as 32-bit uint, indices are computed in 64 bits
+        static const unsigned long MAX_SIZE = 0xffffffffUL;
+
+        typedef std::function<void(const std::string &)> build_logger;
+
+        scanner(const cl::Context &context, const cl::Device &device, const cl::CommandQueue &queue,
+                const std::string &source, build_logger log = build_logger())
+                : context(context), device(device), queue(queue), source(source), log(log) {}
+
+        /**
+         * Caps the elements a work-group scans, zero (the default) lets the device decide.
+         * Must be set before the first scan, compiled programs keep their block size.
+         */
+        void set_max_block_size(unsigned long elements) {
+            assert(programs.empty() && "Block size must be set before the first scan");
+            max_block_sz = elements;
+        }
+
+        // elements a work-group scans in the (type, operator) scans
+        template<class T, class Op = plus>
+        unsigned long block_size(bool segmented = false) {
+            return get_program<T, Op>(segmented).threads * ITEMS_PER_THREAD;
+        }
+
+        template<class T, class Op = plus>
+        void inclusive_scan(const cl::Buffer &input, cl::Buffer &output, unsigned long n,
+                            algorithm type = algorithm::single_pass) {
+            auto &program = get_program<T, Op>(false);
+            if (type == algorithm::tree) {
+                tree_scan(program, sizeof(T), input, output, n);
+            } else {
+                single_pass_scan(program, sizeof(T), input, nullptr, output, n, false);
+            }
+        }
+
+        template<class T, class Op = plus>
+        void exclusive_scan(const cl::Buffer &input, cl::Buffer &output, unsigned long n) {
+            single_pass_scan(get_program<T, Op>(false), sizeof(T), input, nullptr, output, n, true);
+        }
+
+        template<class T, class Op = plus>
+        void segmented_inclusive_scan(const cl::Buffer &input, const cl::Buffer &flags, cl::Buffer &output,
+                                      unsigned long n) {
+            single_pass_scan(get_program<T, Op>(true), sizeof(T), input, &flags, output, n, false);
+        }
+
+        template<class T, class Op = plus>
+        void segmented_exclusive_scan(const cl::Buffer &input, const cl::Buffer &flags, cl::Buffer &output,
+                                      unsigned long n) {
+            single_pass_scan(get_program<T, Op>(true), sizeof(T), input, &flags, output, n, true);
+        }
+
+    private:
+        struct scan_program {
+            cl::Program program;
+            cl::Kernel scan_blocks;
+            cl::Kernel add_block_sums;
+            cl::Kernel scan_single_pass;
+            bool segmented;
+            // work-items in a work-group, power of two
+            unsigned long threads;
+            // bytes of a local scan element, a segmented one carries its flag
+            unsigned long item_sz;
+        };
+
+        template<class T, class Op>
+        scan_program &get_program(bool segmented) {
+            std::string options = std::string("-D SCAN_T=") + type_traits<T>::name() +
+                                  " -D SCAN_T_MIN=" + type_traits<T>::min() +
+                                  " -D SCAN_T_MAX=" + type_traits<T>::max() +
+                                  " -D SCAN_OP=" + Op::name() +
+                                  " -D ITEMS_PER_THREAD=" + std::to_string(ITEMS_PER_THREAD) +
+                                  (segmented ? " -D SEGMENTED" : "");
+            auto found = programs.find(options);
+            if (found != programs.end()) {
+                return found->second;
+            }
+
+            scan_program &result = programs[options];
+            // binaries of earlier runs are reused, see program_cache.h
+            cl_int ret;
+            result.program = cl::Program(program_cache::build_program(context(), device(), source, options, ret));
+            if (log) {
+                log("PROGRAM BUILD LOG (" + options + "):\n" +
+                    result.program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device));
+            }
+            assert(ret == CL_SUCCESS && "Could not build scan kernels");
+
+            result.segmented = segmented;
+            result.scan_single_pass = cl::Kernel(result.program, "scan_single_pass");
+            // a segmented item is {T value; uint flag;}, padded to the alignment of T
+            result.item_sz = segmented ? 2 * std::max(sizeof(T), sizeof(cl_uint)) : sizeof(T);
+            result.threads = work_group_size(result.scan_single_pass, result.item_sz);
+            if (!segmented) {
+                result.scan_blocks = cl::Kernel(result.program, "scan_blocks");
+                result.add_block_sums = cl::Kernel(result.program, "add_block_sums");
+                result.threads = std::min(result.threads, work_group_size(result.scan_blocks, result.item_sz));
+            }
+            return result;
+        }
+
+        /**
+         * The largest power of two work-group size both the device and the kernel allow,
+         * with the block of the work-group still fitting into local memory and into the block size cap.
+         */
+        unsigned long work_group_size(const cl::Kernel &kernel, unsigned long item_sz) const {
+            auto max_sz = std::min(device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>(),
+                                   kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+            auto local_memory_sz = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+
+            unsigned long threads = 1;
+            while (threads * 2 <= max_sz &&
+                   (max_block_sz == 0 || threads * 2 * ITEMS_PER_THREAD <= max_block_sz) &&
+                   item_sz * (threads * 2) * (ITEMS_PER_THREAD + 1) * 33 / 32 <= local_memory_sz) {
+                threads *= 2;
+            }
+            return threads;
+        }
+
+        /**
+         * Inclusive scan entirely on the device. Level 0 scans blocks of the array and writes block totals,
+         * every next level scans the totals of the previous one in place until a single block is left.
+         * Then the scanned totals are combined back level by level. All kernels go to the in-order queue
+         * at once, nothing is read back.
+         */
+        void tree_scan(scan_program &program, unsigned long value_sz, const cl::Buffer &input, cl::Buffer &output,
+                       unsigned long n) {
+            assert(!program.segmented && n <= MAX_SIZE);
+            if (n == 0) {
+                return;
+            }
+            const unsigned long block_sz = program.threads * ITEMS_PER_THREAD;
+
+            // block totals of every level and sizes of the scanned arrays
+            std::vector<cl::Buffer> block_sums;
+            std::vector<unsigned long> sizes;
+
+            for (unsigned long level_n = n; level_n != 0;) {
+                unsigned long block_num = (level_n + block_sz - 1) / block_sz;
+                block_sums.push_back(cl::Buffer(context, CL_MEM_READ_WRITE, value_sz * block_num));
+                sizes.push_back(level_n);
+
+                auto level = block_sums.size() - 1;
+                auto &kernel = program.scan_blocks;
+                kernel.setArg(0, level == 0 ? input : block_sums[level - 1]);
+                kernel.setArg(1, level == 0 ? output : block_sums[level - 1]);
+                kernel.setArg(2, block_sums[level]);
+                kernel.setArg(3, (cl_uint) level_n);
+                kernel.setArg(4, program.item_sz * (block_sz + block_sz / 32), nullptr);
+                kernel.setArg(5, program.item_sz * program.threads, nullptr);
+                queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(block_num * program.threads),
+                                           cl::NDRange(program.threads));
+
+                level_n = block_num == 1 ? 0 : block_num;
+            }
+
+            for (size_t level = block_sums.size() - 1; level-- > 0;) {
+                unsigned long block_num = (sizes[level] + block_sz - 1) / block_sz;
+                auto &kernel = program.add_block_sums;
+                kernel.setArg(0, level == 0 ? output : block_sums[level - 1]);
+                kernel.setArg(1, block_sums[level]);
+                kernel.setArg(2, (cl_uint) sizes[level]);
+                queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(block_num * program.threads),
+                                           cl::NDRange(program.threads));
+            }
+        }
+
+        /**
+         * Scan in a single pass over the array. Work-groups take tiles in the order they start
+         * and resolve the prefix of their tile by looking back at the tiles before it, see scan_single_pass.
+         */
+        void single_pass_scan(scan_program &program, unsigned long value_sz, const cl::Buffer &input,
+                              const cl::Buffer *flags, cl::Buffer &output, unsigned long n, bool exclusive) {
+            assert(n <= MAX_SIZE);
+            const unsigned long block_sz = program.threads * ITEMS_PER_THREAD;
+            unsigned long tiles = std::max((n + block_sz - 1) / block_sz, 1ul);
+
+            cl::Buffer tile_counter(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+            cl::Buffer tile_flags(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * tiles);
+            cl::Buffer tile_aggregates(context, CL_MEM_READ_WRITE, value_sz * tiles);
+            cl::Buffer tile_prefixes(context, CL_MEM_READ_WRITE, value_sz * tiles);
+            queue.enqueueFillBuffer(tile_counter, (cl_uint) 0, 0, sizeof(cl_uint));
+            queue.enqueueFillBuffer(tile_flags, (cl_uint) 0, 0, sizeof(cl_uint) * tiles);
+
+            if (n == 0) {
+                return;
+            }
+            auto &kernel = program.scan_single_pass;
+            kernel.setArg(0, input);
+            // flags are not read by kernels that are not segmented
+            kernel.setArg(1, flags != nullptr ? *flags : input);
+            kernel.setArg(2, output);
+            kernel.setArg(3, tile_counter);
+            kernel.setArg(4, tile_flags);
+            kernel.setArg(5, tile_aggregates);
+            kernel.setArg(6, tile_prefixes);
+            kernel.setArg(7, (cl_uint) n);
+            kernel.setArg(8, (cl_uint) exclusive);
+            kernel.setArg(9, program.item_sz * (block_sz + block_sz / 32), nullptr);
+            kernel.setArg(10, program.item_sz * program.threads, nullptr);
+            queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(tiles * program.threads),
+                                       cl::NDRange(program.threads));
+        }
+
+        cl::Context context;
+        cl::Device device;
+        cl::CommandQueue queue;
+        std::string source;
+        build_logger log;
+        unsigned long max_block_sz = 0;
+        // keyed by build options
+        std::map<std::string, scan_program> programs;
+    };
+}
+
+#endif //AU_PARALLEL_COMPUTING_SCAN_H